@@ -0,0 +1,53 @@
+//
+// Headless batch rendering of Cantina.
+//
+
+#ifndef CANTINA_BATCH_INCLUDE_CANTINA_BATCH_HPP
+#define CANTINA_BATCH_INCLUDE_CANTINA_BATCH_HPP
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * @brief One line of the job list:
+ * seed track midi voices block_size output
+ * with '-' for no track (the seed is tracked) or no midi.
+ */
+struct BatchJob {
+  std::string seed;
+  std::string track;
+  std::string midi;
+  std::size_t nbVoices;
+  std::size_t blockSize;
+  std::string output;
+};
+
+struct BatchOptions {
+  std::string jobList;
+  // 0 to use every core.
+  std::size_t nbThreads = 0;
+  // ADSR envelope with a damper, disabled when negative.
+  int damperController = -1;
+  int damperChannel = 0;
+  bool coalesce = false;
+  // rendered after the seed and the last MIDI event (s).
+  double tail = 1.;
+};
+
+/**
+ * @brief Throws std::runtime_error on malformed lines.
+ */
+std::vector<BatchJob> read_job_list(std::string const &path);
+
+/**
+ * @brief Renders one job, with its own Cantina.
+ * Input is streamed one block at a time,
+ * the output holds one channel per voice.
+ * Throws std::runtime_error or cant::CantinaException on failure.
+ */
+void render_job(BatchJob const &job, BatchOptions const &options);
+
+#endif // CANTINA_BATCH_INCLUDE_CANTINA_BATCH_HPP
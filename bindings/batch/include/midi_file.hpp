@@ -0,0 +1,32 @@
+//
+// Minimal Standard MIDI File reader for offline rendering.
+//
+
+#ifndef CANTINA_BATCH_INCLUDE_MIDI_FILE_HPP
+#define CANTINA_BATCH_INCLUDE_MIDI_FILE_HPP
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct MidiFileEvent {
+  // sample frame at which the event occurs.
+  std::uint64_t frame;
+  std::array<std::uint8_t, 3> data;
+  std::size_t size;
+};
+
+/**
+ * @brief Reads the channel messages of a Standard MIDI File (format 0 or 1),
+ * all tracks merged, with their times converted to sample frames
+ * following the file's tempo map.
+ * Throws std::runtime_error if the file cannot be read or is malformed.
+ */
+std::vector<MidiFileEvent> read_midi_file(std::string const &path,
+                                          double rate);
+
+#endif // CANTINA_BATCH_INCLUDE_MIDI_FILE_HPP
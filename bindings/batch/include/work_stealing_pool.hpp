@@ -0,0 +1,67 @@
+//
+// Thread pool for batch rendering.
+//
+
+#ifndef CANTINA_BATCH_INCLUDE_WORK_STEALING_POOL_HPP
+#define CANTINA_BATCH_INCLUDE_WORK_STEALING_POOL_HPP
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Each worker pops tasks from the back of its own queue,
+ * and steals from the front of the others' when it runs dry.
+ * Tasks are expected to be coarse (a whole render each),
+ * so queues are simply guarded by a mutex.
+ */
+class WorkStealingPool {
+public:
+  using Task = std::function<void()>;
+
+  explicit WorkStealingPool(std::size_t nbThreads);
+  ~WorkStealingPool();
+
+  WorkStealingPool(WorkStealingPool const &) = delete;
+  WorkStealingPool &operator=(WorkStealingPool const &) = delete;
+
+  void submit(Task task);
+  /** Blocks until every submitted task has run. */
+  void wait();
+
+  [[nodiscard]] std::size_t getNumberThreads() const {
+    return m_threads.size();
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  bool pop(std::size_t index, Task &task);
+  bool steal(std::size_t index, Task &task);
+  void work(std::size_t index);
+
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread> m_threads;
+  std::atomic<std::size_t> m_nextQueue;
+
+  std::mutex m_mutex;
+  std::condition_variable m_available;
+  std::condition_variable m_finished;
+  // guarded by m_mutex
+  std::size_t m_queued;
+  std::size_t m_pending;
+  bool m_stop;
+};
+
+#endif // CANTINA_BATCH_INCLUDE_WORK_STEALING_POOL_HPP
@@ -0,0 +1,369 @@
+/**
+ * Offline rendering of Cantina, many jobs at once.
+ * Each job gets its own Cantina and runs on a pool thread.
+ * The clock follows rendered frames instead of wall time,
+ * so every render is deterministic whatever the number of threads.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <getopt.h>
+#include <sndfile.h>
+
+#include "cantina_batch.hpp"
+#include "midi_file.hpp"
+#include "work_stealing_pool.hpp"
+
+#include <cant/Cantina.hpp>
+#include <cant/common/CantinaException.hpp>
+#include <cant/pan/envelope/envelope.hpp>
+
+#include <cantina_common/coalesce.hpp>
+
+namespace {
+
+struct SoundFileCloser {
+  void operator()(SNDFILE *file) const { sf_close(file); }
+};
+using SoundFile = std::unique_ptr<SNDFILE, SoundFileCloser>;
+
+SoundFile open_sound_file(std::string const &path, int mode, SF_INFO &info) {
+  SoundFile file(sf_open(path.data(), mode, &info));
+  if (!file) {
+    throw std::runtime_error(path + ": " + sf_strerror(nullptr));
+  }
+  return file;
+}
+
+/**
+ * @brief libsndfile reads and writes Cantina's sample type directly,
+ * no conversion copy on our side.
+ */
+template <typename Sample>
+sf_count_t read_frames(SNDFILE *file, Sample *data, sf_count_t nbFrames) {
+  if constexpr (std::is_same_v<Sample, double>) {
+    return sf_readf_double(file, data, nbFrames);
+  } else {
+    static_assert(std::is_same_v<Sample, float>, "unsupported sample type");
+    return sf_readf_float(file, data, nbFrames);
+  }
+}
+
+template <typename Sample>
+sf_count_t write_frames(SNDFILE *file, Sample const *data,
+                        sf_count_t nbFrames) {
+  if constexpr (std::is_same_v<Sample, double>) {
+    return sf_writef_double(file, data, nbFrames);
+  } else {
+    static_assert(std::is_same_v<Sample, float>, "unsupported sample type");
+    return sf_writef_float(file, data, nbFrames);
+  }
+}
+
+template <typename Sample> constexpr int sound_file_subformat() {
+  return std::is_same_v<Sample, double> ? SF_FORMAT_DOUBLE : SF_FORMAT_FLOAT;
+}
+
+/**
+ * @brief Streams the first channel of a sound file, one block at a time.
+ * Past the end of the file, blocks are filled with silence.
+ */
+class MonoReader {
+public:
+  MonoReader(std::string const &path, std::size_t blockSize)
+      : m_info(), m_file(open_sound_file(path, SFM_READ, m_info)),
+        m_interleaved(blockSize * static_cast<std::size_t>(m_info.channels)),
+        m_block(blockSize) {}
+
+  [[nodiscard]] int getSampleRate() const { return m_info.samplerate; }
+
+  /** @return number of frames actually read. */
+  std::size_t read() {
+    auto const channels = static_cast<std::size_t>(m_info.channels);
+    auto const nbFrames = static_cast<std::size_t>(
+        read_frames(m_file.get(), m_interleaved.data(),
+                    static_cast<sf_count_t>(m_block.size())));
+    for (std::size_t i = 0; i < nbFrames; ++i) {
+      m_block[i] = m_interleaved[i * channels];
+    }
+    std::fill(m_block.begin() + nbFrames, m_block.end(), cant::sample_f(0));
+    return nbFrames;
+  }
+
+  [[nodiscard]] cant::sample_f const *data() const { return m_block.data(); }
+
+private:
+  SF_INFO m_info;
+  SoundFile m_file;
+  std::vector<cant::sample_f> m_interleaved;
+  std::vector<cant::sample_f> m_block;
+};
+
+std::mutex logMutex;
+
+void log(std::string const &message) {
+  std::lock_guard<std::mutex> lock(logMutex);
+  std::cerr << message << std::endl;
+}
+
+void usage(char const *name) {
+  std::cerr
+      << "Usage: " << name << " [options] JOB_LIST\n"
+      << "  -j, --jobs N             number of threads (default: all cores)\n"
+      << "  -d, --damper CC          add an ADSR envelope damped by CC\n"
+      << "  -c, --damper-channel CH  MIDI channel of the damper (default: 0)\n"
+      << "  -C, --coalesce           keep only the last value of each control\n"
+      << "                           per block, drop repeated notes\n"
+      << "  -t, --tail SECONDS       rendered after the seed and the last\n"
+      << "                           MIDI event (default: 1)\n"
+      << "  -h, --help               show this message\n"
+      << "Each line of JOB_LIST reads:\n"
+      << "  seed track midi voices block_size output\n"
+      << "with '-' for no track (the seed is tracked) or no midi."
+      << std::endl;
+}
+
+bool parse_options(int argc, char **argv, BatchOptions &options) {
+  static option const longOptions[] = {
+      {"jobs", required_argument, nullptr, 'j'},
+      {"damper", required_argument, nullptr, 'd'},
+      {"damper-channel", required_argument, nullptr, 'c'},
+      {"coalesce", no_argument, nullptr, 'C'},
+      {"tail", required_argument, nullptr, 't'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "j:d:c:Ct:h", longOptions, nullptr)) !=
+         -1) {
+    switch (opt) {
+    case 'j':
+      options.nbThreads =
+          static_cast<std::size_t>(std::max(0, std::atoi(optarg)));
+      break;
+    case 'd':
+      options.damperController = std::atoi(optarg);
+      break;
+    case 'c':
+      options.damperChannel = std::atoi(optarg);
+      break;
+    case 'C':
+      options.coalesce = true;
+      break;
+    case 't':
+      options.tail = std::max(0., std::atof(optarg));
+      break;
+    case 'h':
+    default:
+      return false;
+    }
+  }
+  if (optind != argc - 1) {
+    return false;
+  }
+  options.jobList = argv[optind];
+  return true;
+}
+
+} // namespace
+
+std::vector<BatchJob> read_job_list(std::string const &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("could not open job list " + path);
+  }
+  std::vector<BatchJob> jobs;
+  std::string line;
+  std::size_t lineNumber = 0;
+  while (std::getline(file, line)) {
+    ++lineNumber;
+    line = line.substr(0, line.find('#'));
+    std::istringstream stream(line);
+    BatchJob job;
+    if (!(stream >> job.seed)) {
+      // blank line.
+      continue;
+    }
+    if (!(stream >> job.track >> job.midi >> job.nbVoices >> job.blockSize >>
+          job.output) ||
+        job.blockSize == 0) {
+      throw std::runtime_error(path + ":" + std::to_string(lineNumber) +
+                               ": expected seed track midi voices "
+                               "block_size output");
+    }
+    if (job.track == "-") {
+      job.track.clear();
+    }
+    if (job.midi == "-") {
+      job.midi.clear();
+    }
+    jobs.push_back(std::move(job));
+  }
+  return jobs;
+}
+
+void render_job(BatchJob const &job, BatchOptions const &options) {
+  auto const blockSize = job.blockSize;
+  MonoReader seed(job.seed, blockSize);
+  std::unique_ptr<MonoReader> track;
+  if (!job.track.empty()) {
+    track = std::make_unique<MonoReader>(job.track, blockSize);
+    if (track->getSampleRate() != seed.getSampleRate()) {
+      throw std::runtime_error(job.track +
+                               ": sample rate differs from the seed's");
+    }
+  }
+  auto const rate = static_cast<double>(seed.getSampleRate());
+
+  std::vector<MidiFileEvent> events;
+  if (!job.midi.empty()) {
+    events = read_midi_file(job.midi, rate);
+  }
+
+  std::uint64_t frames = 0;
+  cant::Cantina cantina(job.nbVoices, static_cast<cant::type_i>(rate),
+                        1 // channel
+  );
+  cantina.setCustomClock([&frames, rate]() -> cant::time_d {
+    return static_cast<cant::time_d>(frames) / rate;
+  });
+  if (options.damperController >= 0) {
+    auto adsr = cant::pan::ADSREnvelope::make(cantina.getNumberVoices());
+    auto damper = cant::pan::MidiDamper::make(
+        static_cast<cant::pan::id_u8>(options.damperChannel),
+        static_cast<cant::pan::id_u8>(options.damperController));
+    adsr->setController(std::move(damper));
+    cantina.addEnvelope(std::move(adsr));
+  }
+
+  cant::plugin::MidiCoalescer coalescer;
+  coalescer.setEnabled(options.coalesce);
+
+  auto const nbVoices = cantina.getNumberVoices();
+  SF_INFO outputInfo{};
+  outputInfo.samplerate = seed.getSampleRate();
+  outputInfo.channels = static_cast<int>(nbVoices);
+  outputInfo.format =
+      SF_FORMAT_WAV | sound_file_subformat<cant::sample_f>();
+  auto output = open_sound_file(job.output, SFM_WRITE, outputInfo);
+
+  std::vector<std::vector<cant::sample_f>> outputBuffers(
+      nbVoices, std::vector<cant::sample_f>(blockSize));
+  std::vector<cant::sample_f *> interfaceBuffers(nbVoices);
+  std::transform(outputBuffers.begin(), outputBuffers.end(),
+                 interfaceBuffers.begin(),
+                 [](auto &buffer) { return buffer.data(); });
+  std::vector<cant::sample_f> interleaved(blockSize * nbVoices);
+
+  /*
+   * Rendering goes on past the end of the seed, on silence,
+   * until every event is received, then for the tail,
+   * so that releases and the shifter's latency are not cut off.
+   */
+  std::uint64_t const eventsEnd = events.empty() ? 0 : events.back().frame + 1;
+  auto const tailFrames =
+      static_cast<std::uint64_t>(std::round(options.tail * rate));
+  bool seedDone = false;
+  std::uint64_t end = 0;
+  auto event = events.cbegin();
+  while (!seedDone || frames < end) {
+    // zero-padded, and silent past the end.
+    auto const nbSeedFrames = seed.read();
+    if (!seedDone && nbSeedFrames < blockSize) {
+      seedDone = true;
+      end = std::max<std::uint64_t>(frames + nbSeedFrames, eventsEnd) +
+            tailFrames;
+    }
+    auto const nbFrames =
+        seedDone ? static_cast<std::size_t>(
+                       std::min<std::uint64_t>(blockSize, end - frames))
+                 : blockSize;
+    if (nbFrames == 0) {
+      break;
+    }
+    cant::sample_f const *trackData = seed.data();
+    if (track) {
+      track->read();
+      trackData = track->data();
+    }
+    // Same as the LV2 run(): events of the block are received before it.
+    for (; event != events.cend() && event->frame < frames + blockSize;
+         ++event) {
+      coalescer.receiveMidi(cantina, event->data.data(), event->size);
+    }
+    coalescer.flush(cantina);
+    for (auto &buffer : outputBuffers) {
+      std::fill(buffer.begin(), buffer.end(), cant::sample_f(0));
+    }
+    cantina.update();
+    cantina.perform(seed.data(), trackData, interfaceBuffers.data(),
+                    blockSize);
+
+    for (std::size_t i = 0; i < nbFrames; ++i) {
+      for (std::size_t voice = 0; voice < nbVoices; ++voice) {
+        interleaved[i * nbVoices + voice] = outputBuffers[voice][i];
+      }
+    }
+    auto const written = write_frames(output.get(), interleaved.data(),
+                                      static_cast<sf_count_t>(nbFrames));
+    if (written != static_cast<sf_count_t>(nbFrames)) {
+      throw std::runtime_error(job.output + ": " +
+                               sf_strerror(output.get()));
+    }
+    frames += blockSize;
+  }
+}
+
+int main(int argc, char **argv) {
+  BatchOptions options;
+  if (!parse_options(argc, argv, options)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::vector<BatchJob> jobs;
+  try {
+    jobs = read_job_list(options.jobList);
+  } catch (std::runtime_error const &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  auto const nbThreads = options.nbThreads
+                             ? options.nbThreads
+                             : std::max(1u, std::thread::hardware_concurrency());
+  std::vector<char> failed(jobs.size(), false);
+  {
+    WorkStealingPool pool(std::min<std::size_t>(nbThreads, jobs.size()));
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+      pool.submit([&jobs, &options, &failed, i]() {
+        auto const &job = jobs[i];
+        try {
+          render_job(job, options);
+          log("done: " + job.output);
+        } catch (cant::CantinaException const &e) {
+          failed[i] = true;
+          log("failed: " + job.output + ": " + e.what());
+        } catch (std::exception const &e) {
+          failed[i] = true;
+          log("failed: " + job.output + ": " + e.what());
+        }
+      });
+    }
+    pool.wait();
+  }
+  auto const nbFailed = std::count(failed.begin(), failed.end(), true);
+  std::cerr << jobs.size() - nbFailed << "/" << jobs.size()
+            << " jobs rendered." << std::endl;
+  return nbFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,215 @@
+//
+// see: https://www.midi.org/specifications/file-format-specifications/standard-midi-files
+//
+
+#include "midi_file.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::uint32_t DEFAULT_TEMPO = 500000; // us per quarter note, 120 bpm
+
+struct TrackEvent {
+  std::uint64_t tick;
+  bool isTempo;
+  std::uint32_t tempo;
+  MidiFileEvent event;
+};
+
+class Reader {
+public:
+  Reader(std::vector<std::uint8_t> const &bytes, std::size_t begin,
+         std::size_t end)
+      : m_bytes(bytes), m_pos(begin), m_end(end) {}
+
+  [[nodiscard]] bool done() const { return m_pos >= m_end; }
+  [[nodiscard]] std::size_t position() const { return m_pos; }
+
+  std::uint8_t peek() const {
+    check(1);
+    return m_bytes[m_pos];
+  }
+
+  std::uint8_t u8() {
+    check(1);
+    return m_bytes[m_pos++];
+  }
+
+  std::uint32_t u16() {
+    std::uint32_t const high = u8();
+    return (high << 8) | u8();
+  }
+
+  std::uint32_t u32() {
+    std::uint32_t const high = u16();
+    return (high << 16) | u16();
+  }
+
+  std::uint32_t variableLength() {
+    std::uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+      auto const byte = u8();
+      value = (value << 7) | (byte & 0x7F);
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+    throw std::runtime_error("midi file: variable-length quantity too long");
+  }
+
+  void skip(std::size_t count) {
+    check(count);
+    m_pos += count;
+  }
+
+private:
+  void check(std::size_t count) const {
+    if (m_end - std::min(m_pos, m_end) < count) {
+      throw std::runtime_error("midi file: unexpected end of chunk");
+    }
+  }
+
+  std::vector<std::uint8_t> const &m_bytes;
+  std::size_t m_pos;
+  std::size_t m_end;
+};
+
+std::size_t channel_message_length(std::uint8_t status) {
+  switch (status & 0xF0) {
+  case 0xC0:
+  case 0xD0:
+    return 2;
+  default:
+    return 3;
+  }
+}
+
+void read_track(Reader &reader, std::vector<TrackEvent> &events) {
+  std::uint64_t tick = 0;
+  std::uint8_t runningStatus = 0;
+  while (!reader.done()) {
+    tick += reader.variableLength();
+    std::uint8_t status = reader.peek();
+    if (status & 0x80) {
+      reader.u8();
+    } else if (runningStatus) {
+      status = runningStatus;
+    } else {
+      throw std::runtime_error("midi file: data byte without status");
+    }
+    if (status == 0xFF) {
+      auto const type = reader.u8();
+      auto const length = reader.variableLength();
+      if (type == 0x2F) {
+        // end of track.
+        reader.skip(length);
+        return;
+      }
+      if (type == 0x51 && length == 3) {
+        std::uint32_t tempo = reader.u8();
+        tempo = (tempo << 16) | reader.u16();
+        events.push_back({tick, true, tempo, {}});
+      } else {
+        reader.skip(length);
+      }
+      runningStatus = 0;
+    } else if (status == 0xF0 || status == 0xF7) {
+      reader.skip(reader.variableLength());
+      runningStatus = 0;
+    } else if (status >= 0x80 && status < 0xF0) {
+      runningStatus = status;
+      MidiFileEvent event{0, {status, 0, 0}, channel_message_length(status)};
+      for (std::size_t i = 1; i < event.size; ++i) {
+        event.data[i] = reader.u8() & 0x7F;
+      }
+      events.push_back({tick, false, 0, event});
+    } else {
+      throw std::runtime_error("midi file: unsupported status byte");
+    }
+  }
+}
+
+} // namespace
+
+std::vector<MidiFileEvent> read_midi_file(std::string const &path,
+                                          double rate) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("midi file: could not open " + path);
+  }
+  std::vector<std::uint8_t> const bytes(
+      (std::istreambuf_iterator<char>(file)),
+      std::istreambuf_iterator<char>());
+
+  Reader header(bytes, 0, bytes.size());
+  if (header.u32() != 0x4D546864) { // MThd
+    throw std::runtime_error("midi file: missing header in " + path);
+  }
+  auto const headerLength = header.u32();
+  if (headerLength < 6) {
+    throw std::runtime_error("midi file: header too short in " + path);
+  }
+  auto const format = header.u16();
+  auto const nbTracks = header.u16();
+  auto const division = header.u16();
+  header.skip(headerLength - 6);
+  if ((division & 0x7FFF) == 0 || ((division & 0x8000) && !(division & 0xFF))) {
+    throw std::runtime_error("midi file: invalid time division in " + path);
+  }
+  if (format > 1) {
+    throw std::runtime_error("midi file: only formats 0 and 1 are supported");
+  }
+
+  std::vector<TrackEvent> events;
+  std::uint32_t track = 0;
+  while (track < nbTracks && !header.done()) {
+    auto const id = header.u32();
+    auto const length = header.u32();
+    auto const begin = header.position();
+    header.skip(length);
+    // MTrk, other chunks are ignored.
+    if (id == 0x4D54726B) {
+      Reader reader(bytes, begin, begin + length);
+      read_track(reader, events);
+      ++track;
+    }
+  }
+  // stable: events on the same tick keep their file order.
+  std::stable_sort(events.begin(), events.end(),
+                   [](TrackEvent const &a, TrackEvent const &b) {
+                     return a.tick < b.tick;
+                   });
+
+  // ticks to seconds, following the tempo map.
+  double secondsPerTick;
+  bool const smpte = division & 0x8000;
+  if (smpte) {
+    auto fps = -static_cast<std::int8_t>(division >> 8);
+    double const framesPerSecond = fps == 29 ? 29.97 : fps;
+    secondsPerTick = 1. / (framesPerSecond * (division & 0xFF));
+  } else {
+    secondsPerTick = DEFAULT_TEMPO * 1e-6 / division;
+  }
+  std::vector<MidiFileEvent> result;
+  result.reserve(events.size());
+  std::uint64_t lastTick = 0;
+  double seconds = 0.;
+  for (auto const &event : events) {
+    seconds += static_cast<double>(event.tick - lastTick) * secondsPerTick;
+    lastTick = event.tick;
+    if (event.isTempo) {
+      if (!smpte) {
+        secondsPerTick = event.tempo * 1e-6 / division;
+      }
+      continue;
+    }
+    auto midi = event.event;
+    midi.frame = static_cast<std::uint64_t>(seconds * rate);
+    result.push_back(midi);
+  }
+  return result;
+}
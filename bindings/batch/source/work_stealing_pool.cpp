@@ -0,0 +1,95 @@
+#include "work_stealing_pool.hpp"
+
+#include <algorithm>
+
+WorkStealingPool::WorkStealingPool(std::size_t nbThreads)
+    : m_nextQueue(0), m_queued(0), m_pending(0), m_stop(false) {
+  nbThreads = std::max<std::size_t>(1, nbThreads);
+  m_queues.reserve(nbThreads);
+  for (std::size_t i = 0; i < nbThreads; ++i) {
+    m_queues.push_back(std::make_unique<Queue>());
+  }
+  m_threads.reserve(nbThreads);
+  for (std::size_t i = 0; i < nbThreads; ++i) {
+    m_threads.emplace_back(&WorkStealingPool::work, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_available.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+void WorkStealingPool::submit(Task task) {
+  auto const index = m_nextQueue++ % m_queues.size();
+  // counted before it is visible, so that a worker taking it right away
+  // never brings the counters below zero.
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_queued;
+    ++m_pending;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+    m_queues[index]->tasks.push_back(std::move(task));
+  }
+  m_available.notify_one();
+}
+
+void WorkStealingPool::wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_finished.wait(lock, [this]() { return m_pending == 0; });
+}
+
+bool WorkStealingPool::pop(std::size_t index, Task &task) {
+  auto &queue = *m_queues[index];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty()) {
+    return false;
+  }
+  task = std::move(queue.tasks.back());
+  queue.tasks.pop_back();
+  return true;
+}
+
+bool WorkStealingPool::steal(std::size_t index, Task &task) {
+  for (std::size_t i = 1; i < m_queues.size(); ++i) {
+    auto &queue = *m_queues[(index + i) % m_queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::work(std::size_t index) {
+  while (true) {
+    Task task;
+    if (pop(index, task) || steal(index, task)) {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_queued;
+      }
+      task();
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (--m_pending == 0) {
+        m_finished.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_available.wait(lock, [this]() { return m_stop || m_queued > 0; });
+    if (m_stop && m_queued == 0) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,166 @@
+//
+// Coalescing of dense MIDI streams, shared by the bindings.
+//
+
+#ifndef CANTINA_COMMON_COALESCE_HPP
+#define CANTINA_COMMON_COALESCE_HPP
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <cant/Cantina.hpp>
+
+#include "midi.hpp"
+
+namespace cant::plugin {
+
+/**
+ * @brief Thins out MIDI before it reaches Cantina.
+ *
+ * When enabled, controls are held back until the next flush(),
+ * and only the last value per (channel, controller) is dispatched.
+ * Pending controls are also flushed before any note,
+ * so that notes and controls keep their relative order (think dampers).
+ * Notes that would not change anything are dropped:
+ * a note-on for a key already down, a note-off for a key already up.
+ *
+ * When disabled, everything is dispatched right away,
+ * after whatever was still held back.
+ * flush() should be called once per block, before Cantina's update().
+ */
+class MidiCoalescer {
+public:
+  struct Stats {
+    std::uint64_t controlsReceived;
+    std::uint64_t controlsMerged;
+    std::uint64_t notesReceived;
+    std::uint64_t notesDropped;
+  };
+
+  static constexpr size_u NUMBER_CHANNELS = 256; // pan::id_u8
+  static constexpr size_u NUMBER_KEYS = 128;
+
+  MidiCoalescer()
+      : m_enabled(false), m_pendingValues(NUMBER_CHANNELS * NUMBER_KEYS, -1),
+        m_pendingKeys(), m_notesOn(NUMBER_CHANNELS * NUMBER_KEYS, false),
+        m_stats() {
+    // reserved once, so that receiving never allocates.
+    m_pendingKeys.reserve(NUMBER_CHANNELS * NUMBER_KEYS);
+  }
+
+  void setEnabled(bool enabled) { m_enabled = enabled; }
+  [[nodiscard]] bool isEnabled() const { return m_enabled; }
+
+  /** Defaults to printing, see MidiErrorHandler. */
+  void setErrorHandler(MidiErrorHandler onError, void *user = nullptr) {
+    m_onError = onError;
+    m_errorUser = user;
+  }
+
+  void receiveNote(Cantina &cantina, pan::id_u8 channel, pan::tone_i8 tone,
+                   pan::vel_i8 velocity) {
+    auto const key = index(channel, static_cast<pan::id_u8>(tone));
+    bool const on = velocity > 0;
+    if (!m_enabled) {
+      // keys are tracked all the same, enabling must not drop a real note-off.
+      m_notesOn[key] = on;
+      // controls held back before disabling still go first.
+      flush(cantina);
+      dispatch_note(cantina, channel, tone, velocity, m_onError, m_errorUser);
+      return;
+    }
+    ++m_stats.notesReceived;
+    if (m_notesOn[key] == on) {
+      ++m_stats.notesDropped;
+      return;
+    }
+    m_notesOn[key] = on;
+    flush(cantina);
+    dispatch_note(cantina, channel, tone, velocity, m_onError, m_errorUser);
+  }
+
+  void receiveControl(Cantina &cantina, pan::id_u8 channel,
+                      pan::id_u8 controllerId, pan::id_u8 value) {
+    if (!m_enabled) {
+      // controls held back before disabling must not land after this one.
+      flush(cantina);
+      dispatch_control(cantina, channel, controllerId, value, m_onError,
+                       m_errorUser);
+      return;
+    }
+    ++m_stats.controlsReceived;
+    auto const key = index(channel, controllerId);
+    if (m_pendingValues[key] < 0) {
+      m_pendingKeys.push_back(static_cast<std::uint16_t>(key));
+    } else {
+      ++m_stats.controlsMerged;
+    }
+    m_pendingValues[key] = value;
+  }
+
+  void receiveMidi(Cantina &cantina, std::uint8_t const *msg,
+                   std::size_t size) {
+    parse_midi(
+        msg, size,
+        [this, &cantina](pan::id_u8 channel, pan::tone_i8 tone,
+                         pan::vel_i8 velocity) {
+          receiveNote(cantina, channel, tone, velocity);
+        },
+        [this, &cantina](pan::id_u8 channel, pan::id_u8 controllerId,
+                         pan::id_u8 value) {
+          receiveControl(cantina, channel, controllerId, value);
+        });
+  }
+
+  /** Dispatches pending controls, in order of first arrival. */
+  void flush(Cantina &cantina) {
+    for (auto const key : m_pendingKeys) {
+      dispatch_control(cantina, static_cast<pan::id_u8>(key / NUMBER_KEYS),
+                       static_cast<pan::id_u8>(key % NUMBER_KEYS),
+                       static_cast<pan::id_u8>(m_pendingValues[key]),
+                       m_onError, m_errorUser);
+      m_pendingValues[key] = -1;
+    }
+    m_pendingKeys.clear();
+  }
+
+  /**
+   * @brief Flushes, then sends a note-off for every key still down,
+   * e.g. before handing Cantina over to someone else.
+   */
+  void releaseNotes(Cantina &cantina) {
+    flush(cantina);
+    for (size_u key = 0; key < m_notesOn.size(); ++key) {
+      if (m_notesOn[key]) {
+        m_notesOn[key] = false;
+        dispatch_note(cantina, static_cast<pan::id_u8>(key / NUMBER_KEYS),
+                      static_cast<pan::tone_i8>(key % NUMBER_KEYS), 0,
+                      m_onError, m_errorUser);
+      }
+    }
+  }
+
+  [[nodiscard]] Stats const &getStats() const { return m_stats; }
+  void resetStats() { m_stats = Stats(); }
+
+private:
+  static size_u index(pan::id_u8 channel, pan::id_u8 key) {
+    return static_cast<size_u>(channel) * NUMBER_KEYS + (key & 0x7F);
+  }
+
+  bool m_enabled;
+  MidiErrorHandler m_onError = print_midi_error;
+  void *m_errorUser = nullptr;
+  // value waiting to be dispatched, -1 if none.
+  std::vector<std::int16_t> m_pendingValues;
+  std::vector<std::uint16_t> m_pendingKeys;
+  std::vector<bool> m_notesOn;
+  Stats m_stats;
+};
+
+} // namespace cant::plugin
+
+#endif // CANTINA_COMMON_COALESCE_HPP
@@ -0,0 +1,198 @@
+//
+// Confidence gate, shared by the bindings.
+//
+
+#ifndef CANTINA_COMMON_GATE_HPP
+#define CANTINA_COMMON_GATE_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include <cant/common/types.hpp>
+
+namespace cant::plugin {
+
+/**
+ * @brief Skips the pitch-shifting work while nothing pitched is tracked.
+ *
+ * Cantina only exposes a combined track-and-shift perform(),
+ * so while the gate is shut perform() is only called once per probe
+ * interval to keep the tracker listening. The interval is a time,
+ * at most MAX_PROBE_INTERVAL, so that phrase onsets are not clipped
+ * whatever the block size: with large blocks, every block is probed.
+ * The gate opens when the pitch confidence reaches the threshold,
+ * and shuts once it has stayed below (threshold - hysteresis)
+ * for the hold time. Voices fade in over the attack time
+ * and out over the release time, so that it never clicks.
+ *
+ * Use, once per block:
+ *   cantina.update();
+ *   if (gate.shouldPerform(blockSize)) {
+ *     cantina.perform(...);
+ *     gate.observe(cantina.getPitch().getConfidence(), blockSize);
+ *   }
+ *   gate.apply(outputs, numberVoices, blockSize);
+ */
+class ConfidenceGate {
+public:
+  static constexpr type_d DEFAULT_HYSTERESIS = 0.1;
+  static constexpr type_d DEFAULT_HOLD_TIME = 0.2;    // s
+  static constexpr type_d DEFAULT_ATTACK_TIME = 0.005; // s
+  static constexpr type_d DEFAULT_RELEASE_TIME = 0.05; // s
+  static constexpr type_d DEFAULT_PROBE_INTERVAL = 0.005; // s
+  static constexpr type_d MAX_PROBE_INTERVAL = 0.01;      // s
+
+  void setSampleRate(type_d rate) {
+    m_rate = rate;
+    updateTimes();
+  }
+
+  /**
+   * @param threshold confidence in [0, 1] needed to open, 0 disables gating.
+   */
+  void setThreshold(type_d threshold,
+                    type_d hysteresis = DEFAULT_HYSTERESIS) {
+    bool const wasEnabled = isEnabled();
+    m_openThreshold = std::clamp<type_d>(threshold, 0., 1.);
+    m_closeThreshold = std::max<type_d>(0., m_openThreshold - hysteresis);
+    if (!isEnabled()) {
+      reset();
+    } else if (!wasEnabled) {
+      // open for now, only shuts after the hold time.
+      m_holdLeft = m_holdSamples;
+    }
+  }
+
+  void setHoldTime(type_d seconds) {
+    m_holdTime = std::max<type_d>(0., seconds);
+    updateTimes();
+  }
+
+  void setAttackTime(type_d seconds) {
+    m_attackTime = std::max<type_d>(0., seconds);
+    updateTimes();
+  }
+
+  void setReleaseTime(type_d seconds) {
+    m_releaseTime = std::max<type_d>(0., seconds);
+    updateTimes();
+  }
+
+  /** @param seconds clamped to MAX_PROBE_INTERVAL. */
+  void setProbeInterval(type_d seconds) {
+    m_probeInterval = std::clamp<type_d>(seconds, 0., MAX_PROBE_INTERVAL);
+    updateTimes();
+  }
+
+  [[nodiscard]] bool isEnabled() const { return m_openThreshold > 0.; }
+
+  /** Gate fully shut and silent. */
+  [[nodiscard]] bool isShut() const { return m_target == 0. && m_gain == 0.; }
+
+  /**
+   * @brief Whether perform() should be called for this block.
+   */
+  bool shouldPerform(size_u blockSize) {
+    if (!isEnabled() || !isShut()) {
+      m_samplesSinceProbe = 0;
+      return true;
+    }
+    m_samplesSinceProbe += blockSize;
+    if (m_samplesSinceProbe >= m_probeSamples) {
+      m_samplesSinceProbe = 0;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Feeds the confidence of the pitch tracked during the last block.
+   */
+  void observe(type_d confidence, size_u blockSize) {
+    if (!isEnabled()) {
+      return;
+    }
+    if (confidence >= m_openThreshold) {
+      m_target = 1.;
+      m_holdLeft = m_holdSamples;
+    } else if (confidence < m_closeThreshold) {
+      m_holdLeft = m_holdLeft > blockSize ? m_holdLeft - blockSize : 0;
+      if (m_holdLeft == 0) {
+        m_target = 0.;
+      }
+    }
+  }
+
+  /**
+   * @brief Applies the gate gain to the voice buffers.
+   * Buffers are zeroed when the gate is shut,
+   * whether perform() was called or not.
+   */
+  template <typename Sample>
+  void apply(Sample **buffers, size_u numberVoices, size_u blockSize) {
+    if (!isEnabled() || (m_gain == 1. && m_target == 1.)) {
+      return;
+    }
+    if (isShut()) {
+      for (size_u voice = 0; voice < numberVoices; ++voice) {
+        std::fill(buffers[voice], buffers[voice] + blockSize, Sample(0));
+      }
+      return;
+    }
+    auto const step = m_target > m_gain ? m_attackStep : -m_releaseStep;
+    type_d gain = m_gain;
+    for (size_u voice = 0; voice < numberVoices; ++voice) {
+      gain = m_gain;
+      Sample *buffer = buffers[voice];
+      for (size_u i = 0; i < blockSize; ++i) {
+        gain = std::clamp<type_d>(gain + step, 0., 1.);
+        buffer[i] = static_cast<Sample>(buffer[i] * gain);
+      }
+    }
+    m_gain = numberVoices ? gain : m_target;
+  }
+
+  void reset() {
+    m_gain = isEnabled() ? 0. : 1.;
+    m_target = m_gain;
+    m_holdLeft = m_holdSamples;
+    m_samplesSinceProbe = 0;
+  }
+
+private:
+  static type_d rampStep(type_d seconds, type_d rate) {
+    return seconds * rate >= 1. ? 1. / (seconds * rate) : 1.;
+  }
+
+  void updateTimes() {
+    m_holdSamples = static_cast<size_u>(std::round(m_holdTime * m_rate));
+    m_attackStep = rampStep(m_attackTime, m_rate);
+    m_releaseStep = rampStep(m_releaseTime, m_rate);
+    m_probeSamples = static_cast<size_u>(std::round(m_probeInterval * m_rate));
+  }
+
+  type_d m_rate = 44100.;
+  type_d m_openThreshold = 0.;
+  type_d m_closeThreshold = 0.;
+  type_d m_holdTime = DEFAULT_HOLD_TIME;
+  type_d m_attackTime = DEFAULT_ATTACK_TIME;
+  type_d m_releaseTime = DEFAULT_RELEASE_TIME;
+  type_d m_probeInterval = DEFAULT_PROBE_INTERVAL;
+  /* derived */
+  size_u m_holdSamples = static_cast<size_u>(DEFAULT_HOLD_TIME * 44100.);
+  type_d m_attackStep = 1. / (DEFAULT_ATTACK_TIME * 44100.);
+  type_d m_releaseStep = 1. / (DEFAULT_RELEASE_TIME * 44100.);
+  size_u m_probeSamples = static_cast<size_u>(DEFAULT_PROBE_INTERVAL * 44100.);
+  /* state */
+  type_d m_gain = 1.;
+  type_d m_target = 1.;
+  size_u m_holdLeft = 0;
+  size_u m_samplesSinceProbe = 0;
+};
+
+} // namespace cant::plugin
+
+#endif // CANTINA_COMMON_GATE_HPP
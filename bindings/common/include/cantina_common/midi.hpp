@@ -0,0 +1,113 @@
+//
+// Shared MIDI handling for the bindings that receive raw MIDI bytes.
+//
+
+#ifndef CANTINA_COMMON_MIDI_HPP
+#define CANTINA_COMMON_MIDI_HPP
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include <cant/Cantina.hpp>
+#include <cant/pan/control/control.hpp>
+#include <cant/pan/note/note.hpp>
+
+#include <cant/common/CantinaException.hpp>
+
+namespace cant::plugin {
+
+enum EMidiStatus : std::uint8_t {
+  MIDI_STATUS_NOTE_OFF = 0x80,
+  MIDI_STATUS_NOTE_ON = 0x90,
+  MIDI_STATUS_CONTROLLER = 0xB0
+};
+
+/**
+ * @brief Called when Cantina rejects a note or a control,
+ * from the thread that dispatched it.
+ * Bindings dispatching from a real-time thread should not print from it.
+ */
+using MidiErrorHandler = void (*)(CantinaException const &e, void *user);
+
+inline void print_midi_error(CantinaException const &e, void *) {
+  std::cerr << e.what() << std::endl;
+}
+
+inline void dispatch_note(Cantina &cantina, pan::id_u8 channel,
+                          pan::tone_i8 tone, pan::vel_i8 velocity,
+                          MidiErrorHandler onError = print_midi_error,
+                          void *user = nullptr) {
+  try {
+    cantina.receiveNote(pan::MidiNoteInputData(channel, tone, velocity));
+  } catch (CantinaException const &e) {
+    onError(e, user);
+  }
+}
+
+inline void dispatch_control(Cantina &cantina, pan::id_u8 channel,
+                             pan::id_u8 controllerId, pan::id_u8 value,
+                             MidiErrorHandler onError = print_midi_error,
+                             void *user = nullptr) {
+  try {
+    cantina.receiveControl(
+        pan::MidiControlInputData(channel, controllerId, value));
+  } catch (CantinaException const &e) {
+    onError(e, user);
+  }
+}
+
+/**
+ * @brief Splits a raw MIDI message into notes and controls,
+ * everything else is ignored.
+ * Note-offs are given as zero-velocity notes, the way Cantina expects them.
+ */
+template <typename OnNote, typename OnControl>
+inline void parse_midi(std::uint8_t const *msg, std::size_t size,
+                       OnNote &&onNote, OnControl &&onControl) {
+  if (size < 3) {
+    return;
+  }
+  auto const channel = static_cast<pan::id_u8>(msg[0] & 0x0F);
+  switch (msg[0] & 0xF0) {
+  case MIDI_STATUS_NOTE_ON:
+  case MIDI_STATUS_NOTE_OFF: {
+    auto const velocity = (msg[0] & 0xF0) == MIDI_STATUS_NOTE_OFF
+                              ? static_cast<pan::vel_i8>(0)
+                              : static_cast<pan::vel_i8>(msg[2]);
+    onNote(channel, static_cast<pan::tone_i8>(msg[1]), velocity);
+    break;
+  }
+  case MIDI_STATUS_CONTROLLER:
+    onControl(channel, static_cast<pan::id_u8>(msg[1]),
+              static_cast<pan::id_u8>(msg[2]));
+    break;
+  default:
+    break;
+  }
+}
+
+/**
+ * @brief Forwards a raw MIDI message to Cantina.
+ */
+inline void receive_midi(Cantina &cantina, std::uint8_t const *msg,
+                         std::size_t size,
+                         MidiErrorHandler onError = print_midi_error,
+                         void *user = nullptr) {
+  parse_midi(
+      msg, size,
+      [&cantina, onError, user](pan::id_u8 channel, pan::tone_i8 tone,
+                                pan::vel_i8 velocity) {
+        dispatch_note(cantina, channel, tone, velocity, onError, user);
+      },
+      [&cantina, onError, user](pan::id_u8 channel, pan::id_u8 controllerId,
+                                pan::id_u8 value) {
+        dispatch_control(cantina, channel, controllerId, value, onError, user);
+      });
+}
+
+} // namespace cant::plugin
+
+#endif // CANTINA_COMMON_MIDI_HPP
@@ -0,0 +1,122 @@
+//
+// Sample format conversion at the boundary between host and Cantina.
+//
+
+#ifndef CANTINA_COMMON_SAMPLE_HPP
+#define CANTINA_COMMON_SAMPLE_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#include <cant/common/types.hpp>
+
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define CANTINA_RESTRICT __restrict
+#else
+#define CANTINA_RESTRICT
+#endif
+
+namespace cant::plugin {
+
+/**
+ * @brief Plain loop on non-aliasing buffers,
+ * so that the compiler vectorises it.
+ */
+template <typename From, typename To>
+inline void convert_samples(From const *CANTINA_RESTRICT in,
+                            To *CANTINA_RESTRICT out, size_u blockSize) {
+  for (size_u i = 0; i < blockSize; ++i) {
+    out[i] = static_cast<To>(in[i]);
+  }
+}
+
+/**
+ * @brief Hands host buffers to Cantina.
+ * When the host's sample type is Cantina's, buffers are passed through
+ * as they are. Otherwise they are converted into scratch buffers,
+ * allocated beforehand with allocate().
+ *
+ * Use, once per block:
+ *   auto seed = bridge.seed(in_seed, blockSize);
+ *   auto track = bridge.track(in_track, blockSize);
+ *   auto outputs = bridge.outputs(out_voices, numberVoices, blockSize);
+ *   cantina.perform(seed, track, outputs, blockSize);
+ *   bridge.commit(out_voices, numberVoices, blockSize);
+ */
+template <typename Sample> class SampleBridge {
+public:
+  static constexpr bool isNative = std::is_same_v<Sample, sample_f>;
+
+  /** Not real-time safe, call it when the block size changes. */
+  void allocate(size_u numberVoices, size_u blockSize) {
+    if constexpr (!isNative) {
+      m_seed.assign(blockSize, sample_f(0));
+      m_track.assign(blockSize, sample_f(0));
+      m_outputs.assign(numberVoices, std::vector<sample_f>(blockSize));
+      m_outputPointers.resize(numberVoices);
+      for (size_u voice = 0; voice < numberVoices; ++voice) {
+        m_outputPointers[voice] = m_outputs[voice].data();
+      }
+    }
+  }
+
+  sample_f const *seed(Sample const *in, size_u blockSize) {
+    m_seedIn = in;
+    if constexpr (isNative) {
+      return in;
+    } else {
+      convert_samples(in, m_seed.data(), blockSize);
+      return m_seed.data();
+    }
+  }
+
+  /** Call after seed(), the track is often the seed itself. */
+  sample_f const *track(Sample const *in, size_u blockSize) {
+    if constexpr (isNative) {
+      return in;
+    } else {
+      if (in == m_seedIn) {
+        return m_seed.data();
+      }
+      convert_samples(in, m_track.data(), blockSize);
+      return m_track.data();
+    }
+  }
+
+  /** Cleared, ready to be written to. */
+  sample_f **outputs(Sample **out, size_u numberVoices, size_u blockSize) {
+    sample_f **buffers;
+    if constexpr (isNative) {
+      buffers = out;
+    } else {
+      buffers = m_outputPointers.data();
+    }
+    for (size_u voice = 0; voice < numberVoices; ++voice) {
+      std::fill(buffers[voice], buffers[voice] + blockSize, sample_f(0));
+    }
+    return buffers;
+  }
+
+  void commit(Sample **out, size_u numberVoices, size_u blockSize) {
+    if constexpr (!isNative) {
+      for (size_u voice = 0; voice < numberVoices; ++voice) {
+        convert_samples(m_outputPointers[voice], out[voice], blockSize);
+      }
+    }
+  }
+
+private:
+  Sample const *m_seedIn = nullptr;
+  std::vector<sample_f> m_seed;
+  std::vector<sample_f> m_track;
+  std::vector<std::vector<sample_f>> m_outputs;
+  std::vector<sample_f *> m_outputPointers;
+};
+
+} // namespace cant::plugin
+
+#endif // CANTINA_COMMON_SAMPLE_HPP
@@ -0,0 +1,275 @@
+//
+// Per-voice post-processing, shared by the bindings.
+//
+
+#ifndef CANTINA_COMMON_VOICE_CHAIN_HPP
+#define CANTINA_COMMON_VOICE_CHAIN_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <cant/common/types.hpp>
+
+namespace cant::plugin {
+
+constexpr type_d PI = 3.14159265358979323846;
+
+inline type_d db_to_coef(type_d gain) {
+  return gain > -90. ? std::pow(10., gain * 0.05) : 0.;
+}
+
+/**
+ * @brief A fixed menu of stages, applied to each voice in a single pass
+ * while its buffer is still in cache, in this order:
+ * soft clip, decimation, bit-crush, one-pole low-pass tone, gain and pan.
+ *
+ * Stages are switched on and off per voice, and each combination
+ * has its own loop, so disabled stages cost nothing.
+ * Pan only means something when mixing to stereo,
+ * voices rendered to mono outputs ignore it.
+ */
+class VoiceChain {
+public:
+  static constexpr size_u ALL_VOICES = static_cast<size_u>(-1);
+
+  /** Not real-time safe, resets every voice. */
+  void setNumberVoices(size_u numberVoices) {
+    m_stages.assign(numberVoices, Stages());
+    m_states.assign(numberVoices, State());
+  }
+
+  [[nodiscard]] size_u getNumberVoices() const { return m_stages.size(); }
+
+  void setSampleRate(type_d rate) {
+    m_rate = rate;
+    for (auto &stages : m_stages) {
+      stages.toneCoef = toneCoef(stages.toneFreq);
+    }
+  }
+
+  void setGain(size_u voice, type_d gainDb) {
+    forVoices(voice, [gainDb](Stages &stages) {
+      stages.gain = static_cast<sample_f>(db_to_coef(gainDb));
+    });
+  }
+
+  /** @param pan in [-1, 1], from left to right. */
+  void setPan(size_u voice, type_d pan) {
+    forVoices(voice, [pan](Stages &stages) {
+      stages.pan = std::clamp<type_d>(pan, -1., 1.);
+    });
+  }
+
+  /** @param driveDb gain into the soft clipper, 0 disables it. */
+  void setDrive(size_u voice, type_d driveDb) {
+    forVoices(voice, [driveDb](Stages &stages) {
+      stages.drive = driveDb > 0. ? static_cast<sample_f>(db_to_coef(driveDb))
+                                  : sample_f(0);
+    });
+  }
+
+  /**
+   * @param bitDepth in [1, 24], 0 disables bit-crushing.
+   * @param rate fraction of samples kept, in (0, 1],
+   * 1 or anything not above 0 disables decimation.
+   * Same as bitcrush~.
+   */
+  void setCrush(size_u voice, int bitDepth, type_d rate = 1.) {
+    forVoices(voice, [bitDepth, rate](Stages &stages) {
+      auto const depth = std::clamp(bitDepth, 0, 24);
+      stages.steps =
+          depth ? static_cast<sample_f>(std::ldexp(1., depth - 1)) : 0;
+      // keeping no sample at all would hold the last one forever.
+      stages.rate = rate > 0. ? std::min<type_d>(rate, 1.) : 1.;
+    });
+  }
+
+  /** @param freq cut-off of the low-pass in Hz, 0 disables it. */
+  void setTone(size_u voice, type_d freq) {
+    forVoices(voice, [this, freq](Stages &stages) {
+      stages.toneFreq = std::max<type_d>(0., freq);
+      stages.toneCoef = toneCoef(stages.toneFreq);
+    });
+  }
+
+  /**
+   * @brief Processes a voice in place, for voices with their own output.
+   */
+  template <typename Sample>
+  void process(size_u voice, Sample *buffer, size_u blockSize) {
+    auto const &stages = m_stages[voice];
+    if (!hasStages(stages) && stages.gain == sample_f(1)) {
+      return;
+    }
+    auto const gain = stages.gain;
+    dispatch(voice, buffer, blockSize, [buffer, gain](size_u i, sample_f x) {
+      buffer[i] = static_cast<Sample>(x * gain);
+    });
+  }
+
+  /**
+   * @brief Processes a voice and adds it to a mono mix.
+   */
+  template <typename Sample>
+  void mix(size_u voice, sample_f const *buffer, Sample *output,
+           size_u blockSize) {
+    auto const gain = m_stages[voice].gain;
+    dispatch(voice, buffer, blockSize, [output, gain](size_u i, sample_f x) {
+      output[i] += static_cast<Sample>(x * gain);
+    });
+  }
+
+  /**
+   * @brief Processes a voice and adds it to a stereo mix,
+   * with a constant-power pan.
+   */
+  template <typename Sample>
+  void mix(size_u voice, sample_f const *buffer, Sample *left, Sample *right,
+           size_u blockSize) {
+    auto const &stages = m_stages[voice];
+    auto const angle = (stages.pan + 1.) * PI / 4.;
+    auto const gainLeft = static_cast<sample_f>(stages.gain * std::cos(angle));
+    auto const gainRight =
+        static_cast<sample_f>(stages.gain * std::sin(angle));
+    dispatch(voice, buffer, blockSize,
+             [left, right, gainLeft, gainRight](size_u i, sample_f x) {
+               left[i] += static_cast<Sample>(x * gainLeft);
+               right[i] += static_cast<Sample>(x * gainRight);
+             });
+  }
+
+private:
+  struct Stages {
+    sample_f gain = 1;
+    type_d pan = 0.;
+    sample_f drive = 0;
+    sample_f steps = 0;
+    type_d rate = 1.;
+    type_d toneFreq = 0.;
+    sample_f toneCoef = 0;
+  };
+
+  struct State {
+    type_d acc = 0.;
+    sample_f held = 0;
+    sample_f lowpass = 0;
+  };
+
+  enum EStage { STAGE_CLIP = 0, STAGE_DECIMATE, STAGE_CRUSH, STAGE_TONE };
+
+  static bool isActive(Stages const &stages, size_u stage) {
+    switch (stage) {
+    case STAGE_CLIP:
+      return stages.drive > sample_f(0);
+    case STAGE_DECIMATE:
+      return stages.rate < 1.;
+    case STAGE_CRUSH:
+      return stages.steps > sample_f(0);
+    case STAGE_TONE:
+      return stages.toneCoef > sample_f(0);
+    default:
+      return false;
+    }
+  }
+
+  static bool hasStages(Stages const &stages) {
+    return isActive(stages, STAGE_CLIP) || isActive(stages, STAGE_DECIMATE) ||
+           isActive(stages, STAGE_CRUSH) || isActive(stages, STAGE_TONE);
+  }
+
+  /** Rational approximation of tanh, saturating at +-1. */
+  static sample_f softClip(sample_f x) {
+    x = std::clamp<sample_f>(x, -3, 3);
+    return x * (27 + x * x) / (27 + 9 * x * x);
+  }
+
+  /**
+   * Decaying state reaches subnormals during silence,
+   * which then slow down every sample of the voice.
+   */
+  static sample_f flushDenormal(sample_f x) {
+    return std::abs(x) < sample_f(1e-15) ? sample_f(0) : x;
+  }
+
+  sample_f toneCoef(type_d freq) const {
+    return freq > 0. ? static_cast<sample_f>(
+                           1. - std::exp(-2. * PI * freq / m_rate))
+                     : sample_f(0);
+  }
+
+  template <typename Function> void forVoices(size_u voice, Function f) {
+    if (voice == ALL_VOICES) {
+      std::for_each(m_stages.begin(), m_stages.end(), f);
+    } else if (voice < m_stages.size()) {
+      f(m_stages[voice]);
+    }
+  }
+
+  /**
+   * @brief Picks the loop matching the active stages of the voice,
+   * one stage at a time.
+   */
+  template <bool... Active, typename Input, typename Write>
+  void dispatch(size_u voice, Input const *buffer, size_u blockSize,
+                Write &&write) {
+    constexpr size_u stage = sizeof...(Active);
+    if constexpr (stage == 4) {
+      run<Active...>(m_stages[voice], m_states[voice], buffer, blockSize,
+                     write);
+    } else {
+      if (isActive(m_stages[voice], stage)) {
+        dispatch<Active..., true>(voice, buffer, blockSize, write);
+      } else {
+        dispatch<Active..., false>(voice, buffer, blockSize, write);
+      }
+    }
+  }
+
+  template <bool Clip, bool Decimate, bool Crush, bool Tone, typename Input,
+            typename Write>
+  static void run(Stages const &stages, State &state, Input const *buffer,
+                  size_u blockSize, Write &write) {
+    type_d acc = state.acc;
+    sample_f held = state.held;
+    sample_f lowpass = state.lowpass;
+    for (size_u i = 0; i < blockSize; ++i) {
+      auto x = static_cast<sample_f>(buffer[i]);
+      if constexpr (Clip) {
+        x = softClip(x * stages.drive);
+      }
+      if constexpr (Decimate) {
+        acc += stages.rate;
+        if (acc >= 1.) {
+          acc -= 1.;
+          held = x;
+        }
+        x = held;
+      }
+      if constexpr (Crush) {
+        // truncation, as bitcrush~ does.
+        x = static_cast<sample_f>(static_cast<long>(x * stages.steps)) /
+            stages.steps;
+      }
+      if constexpr (Tone) {
+        lowpass += stages.toneCoef * (x - lowpass);
+        x = lowpass;
+      }
+      write(i, x);
+    }
+    state.acc = acc;
+    state.held = flushDenormal(held);
+    state.lowpass = flushDenormal(lowpass);
+  }
+
+  type_d m_rate = 44100.;
+  std::vector<Stages> m_stages;
+  std::vector<State> m_states;
+};
+
+} // namespace cant::plugin
+
+#endif // CANTINA_COMMON_VOICE_CHAIN_HPP
@@ -0,0 +1,70 @@
+//
+// Standalone JACK client for Cantina.
+//
+
+#ifndef CANTINA_JACK_INCLUDE_CANTINA_JACK_HPP
+#define CANTINA_JACK_INCLUDE_CANTINA_JACK_HPP
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+#include <cant/Cantina.hpp>
+
+#include <cantina_common/coalesce.hpp>
+#include <cantina_common/gate.hpp>
+#include <cantina_common/sample.hpp>
+
+struct CantinaJackOptions {
+  std::string clientName = "cantina";
+  std::string serverName;
+  std::size_t nbVoices = 4;
+  // ADSR envelope with a damper, disabled when negative.
+  int damperController = -1;
+  int damperChannel = 0;
+  // confidence gate, disabled when 0.
+  double gateThreshold = 0.;
+  double gateHold = cant::plugin::ConfidenceGate::DEFAULT_HOLD_TIME * 1000.;
+  double gateRelease =
+      cant::plugin::ConfidenceGate::DEFAULT_RELEASE_TIME * 1000.;
+  bool coalesce = false;
+  std::vector<std::string> connectMidi;
+  std::vector<std::string> connectSeed;
+  std::vector<std::string> connectTrack;
+  std::vector<std::string> connectOutputs;
+};
+
+struct CantinaJack {
+  jack_client_t *client;
+
+  struct {
+    jack_port_t *midi_in;
+    jack_port_t *input_seed;
+    jack_port_t *input_track;
+    std::vector<jack_port_t *> outputs;
+  } ports;
+
+  double rate;
+  // frames processed so far, drives Cantina's clock.
+  std::uint64_t frames;
+  // Cantina errors in the process callback (blocks and MIDI),
+  // reported from the main loop.
+  std::atomic<std::uint64_t> errors;
+  // Cantina
+  std::unique_ptr<cant::Cantina> cantina;
+  cant::plugin::ConfidenceGate gate;
+  cant::plugin::MidiCoalescer coalescer;
+  // per-voice JACK buffers, refreshed every cycle.
+  std::vector<jack_default_audio_sample_t *> outputBuffers;
+  // converts only if JACK's sample type is not Cantina's.
+  cant::plugin::SampleBridge<jack_default_audio_sample_t> bridge;
+};
+
+#endif // CANTINA_JACK_INCLUDE_CANTINA_JACK_HPP
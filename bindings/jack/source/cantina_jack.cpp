@@ -0,0 +1,360 @@
+/**
+ * Cantina as a standalone JACK client:
+ * one MIDI input, seed and track audio inputs, one audio output per voice.
+ * Cantina renders straight into the JACK port buffers,
+ * nothing is allocated once the client is activated.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+#include "cantina_jack.hpp"
+
+#include <cant/common/CantinaException.hpp>
+#include <cant/common/config.hpp>
+#include <cant/pan/envelope/envelope.hpp>
+
+#include <cantina_common/midi.hpp>
+
+static std::atomic<bool> running(true);
+
+static void usage(char const *name) {
+  std::cerr
+      << "Usage: " << name << " [options]\n"
+      << "  -n, --name NAME          JACK client name (default: cantina)\n"
+      << "  -s, --server NAME        JACK server to connect to\n"
+      << "  -v, --voices N           number of voices (default: 4)\n"
+      << "  -d, --damper CC          add an ADSR envelope damped by CC\n"
+      << "  -c, --damper-channel CH  MIDI channel of the damper (default: 0)\n"
+      << "  -g, --gate THRESHOLD     only shift above this pitch confidence\n"
+      << "      --gate-hold MS       time the gate stays open (default: 200)\n"
+      << "      --gate-release MS    fade-out time of the gate (default: 50)\n"
+      << "  -C, --coalesce           keep only the last value of each control\n"
+      << "                           per cycle, drop repeated notes\n"
+      << "  -m, --connect-midi PORT  connect MIDI input to PORT\n"
+      << "  -i, --connect-seed PORT  connect seed input to PORT\n"
+      << "  -t, --connect-track PORT connect track input to PORT\n"
+      << "  -o, --connect-out PORT   connect next voice output to PORT\n"
+      << "  -h, --help               show this message\n"
+      << "If the track input is left unconnected, the seed is tracked."
+      << std::endl;
+}
+
+enum ELongOnlyOption { OPTION_GATE_HOLD = 256, OPTION_GATE_RELEASE };
+
+static bool parse_options(int argc, char **argv, CantinaJackOptions &options) {
+  static option const longOptions[] = {
+      {"name", required_argument, nullptr, 'n'},
+      {"server", required_argument, nullptr, 's'},
+      {"voices", required_argument, nullptr, 'v'},
+      {"damper", required_argument, nullptr, 'd'},
+      {"damper-channel", required_argument, nullptr, 'c'},
+      {"gate", required_argument, nullptr, 'g'},
+      {"gate-hold", required_argument, nullptr, OPTION_GATE_HOLD},
+      {"gate-release", required_argument, nullptr, OPTION_GATE_RELEASE},
+      {"coalesce", no_argument, nullptr, 'C'},
+      {"connect-midi", required_argument, nullptr, 'm'},
+      {"connect-seed", required_argument, nullptr, 'i'},
+      {"connect-track", required_argument, nullptr, 't'},
+      {"connect-out", required_argument, nullptr, 'o'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:s:v:d:c:g:Cm:i:t:o:h", longOptions,
+                            nullptr)) != -1) {
+    switch (opt) {
+    case 'n':
+      options.clientName = optarg;
+      break;
+    case 's':
+      options.serverName = optarg;
+      break;
+    case 'v':
+      options.nbVoices =
+          static_cast<std::size_t>(std::max(0, std::atoi(optarg)));
+      break;
+    case 'd':
+      options.damperController = std::atoi(optarg);
+      break;
+    case 'c':
+      options.damperChannel = std::atoi(optarg);
+      break;
+    case 'g':
+      options.gateThreshold = std::atof(optarg);
+      break;
+    case OPTION_GATE_HOLD:
+      options.gateHold = std::atof(optarg);
+      break;
+    case OPTION_GATE_RELEASE:
+      options.gateRelease = std::atof(optarg);
+      break;
+    case 'C':
+      options.coalesce = true;
+      break;
+    case 'm':
+      options.connectMidi.emplace_back(optarg);
+      break;
+    case 'i':
+      options.connectSeed.emplace_back(optarg);
+      break;
+    case 't':
+      options.connectTrack.emplace_back(optarg);
+      break;
+    case 'o':
+      options.connectOutputs.emplace_back(optarg);
+      break;
+    case 'h':
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Sample>
+static void process_block(CantinaJack *self,
+                          cant::plugin::SampleBridge<Sample> &bridge,
+                          Sample const *input_seed, Sample const *input_track,
+                          Sample **outputs, jack_nframes_t nb_frames) {
+  auto const nb_voices = self->outputBuffers.size();
+  auto seed = bridge.seed(input_seed, nb_frames);
+  auto track = bridge.track(input_track, nb_frames);
+  auto voices = bridge.outputs(outputs, nb_voices, nb_frames);
+
+  self->cantina->update();
+  if (self->gate.shouldPerform(nb_frames)) {
+    self->cantina->perform(seed, track, voices, nb_frames);
+    self->gate.observe(self->cantina->getPitch().getConfidence(), nb_frames);
+  }
+  self->gate.apply(voices, nb_voices, nb_frames);
+  bridge.commit(outputs, nb_voices, nb_frames);
+}
+
+static int process(jack_nframes_t nb_frames, void *arg) {
+  auto self = static_cast<CantinaJack *>(arg);
+  using Sample = jack_default_audio_sample_t;
+
+  // Notes and controls
+  void *midi = jack_port_get_buffer(self->ports.midi_in, nb_frames);
+  jack_nframes_t const nb_events = jack_midi_get_event_count(midi);
+  for (jack_nframes_t i = 0; i < nb_events; ++i) {
+    jack_midi_event_t ev;
+    if (jack_midi_event_get(&ev, midi, i) != 0) {
+      continue;
+    }
+    self->coalescer.receiveMidi(*self->cantina, ev.buffer, ev.size);
+  }
+  self->coalescer.flush(*self->cantina);
+
+  auto seed = static_cast<Sample const *>(
+      jack_port_get_buffer(self->ports.input_seed, nb_frames));
+  auto track = jack_port_connected(self->ports.input_track)
+                   ? static_cast<Sample const *>(jack_port_get_buffer(
+                         self->ports.input_track, nb_frames))
+                   : seed;
+  for (std::size_t voice = 0; voice < self->outputBuffers.size(); ++voice) {
+    self->outputBuffers[voice] = static_cast<Sample *>(
+        jack_port_get_buffer(self->ports.outputs[voice], nb_frames));
+  }
+
+  try {
+    process_block(self, self->bridge, seed, track,
+                  self->outputBuffers.data(), nb_frames);
+  } catch (cant::CantinaException const &) {
+    // no printing from the real-time thread.
+    self->errors.fetch_add(1, std::memory_order_relaxed);
+  }
+  self->frames += nb_frames;
+  return 0;
+}
+
+static int sample_rate_changed(jack_nframes_t rate, void *arg) {
+  auto self = static_cast<CantinaJack *>(arg);
+  if (static_cast<double>(rate) != self->rate) {
+    std::cerr << "cantina_jack: sample rate changed to " << rate
+              << ", restart the client." << std::endl;
+    running = false;
+  }
+  return 0;
+}
+
+static int buffer_size_changed(jack_nframes_t nb_frames, void *arg) {
+  auto self = static_cast<CantinaJack *>(arg);
+  self->bridge.allocate(self->outputBuffers.size(), nb_frames);
+  return 0;
+}
+
+static void shutdown(void *) { running = false; }
+
+static void signal_handler(int) { running = false; }
+
+static void set_cantina(CantinaJack *self, CantinaJackOptions const &options) {
+  self->cantina = std::make_unique<cant::Cantina>(
+      options.nbVoices, static_cast<cant::type_i>(self->rate),
+      1 // channel
+  );
+  self->cantina->setCustomClock([self]() -> cant::time_d {
+    return static_cast<cant::time_d>(self->frames) / self->rate;
+  });
+  self->coalescer.setEnabled(options.coalesce);
+  // dispatched from the process callback, counted like the other errors.
+  self->coalescer.setErrorHandler(
+      [](cant::CantinaException const &, void *user) {
+        static_cast<CantinaJack *>(user)->errors.fetch_add(
+            1, std::memory_order_relaxed);
+      },
+      self);
+  self->gate.setSampleRate(self->rate);
+  self->gate.setThreshold(options.gateThreshold);
+  self->gate.setHoldTime(options.gateHold / 1000.);
+  self->gate.setReleaseTime(options.gateRelease / 1000.);
+  if (options.damperController >= 0) {
+    auto adsr = cant::pan::ADSREnvelope::make(self->cantina->getNumberVoices());
+    auto damper = cant::pan::MidiDamper::make(
+        static_cast<cant::pan::id_u8>(options.damperChannel),
+        static_cast<cant::pan::id_u8>(options.damperController));
+    adsr->setController(std::move(damper));
+    self->cantina->addEnvelope(std::move(adsr));
+  }
+}
+
+static bool register_ports(CantinaJack *self) {
+  self->ports.midi_in = jack_port_register(
+      self->client, "midi_in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+  self->ports.input_seed = jack_port_register(
+      self->client, "in_seed", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+  self->ports.input_track = jack_port_register(
+      self->client, "in_track", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+  if (!self->ports.midi_in || !self->ports.input_seed ||
+      !self->ports.input_track) {
+    return false;
+  }
+  auto const nb_voices = self->cantina->getNumberVoices();
+  self->ports.outputs.resize(nb_voices);
+  self->outputBuffers.resize(nb_voices);
+  for (std::size_t voice = 0; voice < nb_voices; ++voice) {
+    auto const name = "out_" + std::to_string(voice + 1);
+    self->ports.outputs[voice] =
+        jack_port_register(self->client, name.data(), JACK_DEFAULT_AUDIO_TYPE,
+                           JackPortIsOutput, 0);
+    if (!self->ports.outputs[voice]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void connect_ports(CantinaJack *self,
+                          CantinaJackOptions const &options) {
+  auto connect = [self](char const *source, char const *destination) {
+    if (jack_connect(self->client, source, destination) != 0) {
+      std::cerr << "cantina_jack: could not connect " << source << " to "
+                << destination << std::endl;
+    }
+  };
+  for (auto const &port : options.connectMidi) {
+    connect(port.data(), jack_port_name(self->ports.midi_in));
+  }
+  for (auto const &port : options.connectSeed) {
+    connect(port.data(), jack_port_name(self->ports.input_seed));
+  }
+  for (auto const &port : options.connectTrack) {
+    connect(port.data(), jack_port_name(self->ports.input_track));
+  }
+  auto const nb_outputs =
+      std::min(options.connectOutputs.size(), self->ports.outputs.size());
+  for (std::size_t voice = 0; voice < nb_outputs; ++voice) {
+    connect(jack_port_name(self->ports.outputs[voice]),
+            options.connectOutputs[voice].data());
+  }
+}
+
+int main(int argc, char **argv) {
+  CantinaJackOptions options;
+  if (!parse_options(argc, argv, options)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  auto self = std::make_unique<CantinaJack>();
+  jack_status_t status;
+  auto const open_options = options.serverName.empty()
+                                ? JackNoStartServer
+                                : static_cast<jack_options_t>(
+                                      JackNoStartServer | JackServerName);
+  self->client = jack_client_open(options.clientName.data(), open_options,
+                                  &status, options.serverName.data());
+  if (!self->client) {
+    std::cerr << "cantina_jack: could not open JACK client (status 0x"
+              << std::hex << status << ")." << std::endl;
+    return EXIT_FAILURE;
+  }
+  self->rate = jack_get_sample_rate(self->client);
+  self->frames = 0;
+  self->errors = 0;
+
+  try {
+    set_cantina(self.get(), options);
+  } catch (cant::CantinaException const &e) {
+    std::cerr << e.what() << std::endl;
+    jack_client_close(self->client);
+    return EXIT_FAILURE;
+  }
+  if (!register_ports(self.get())) {
+    std::cerr << "cantina_jack: could not register ports." << std::endl;
+    jack_client_close(self->client);
+    return EXIT_FAILURE;
+  }
+
+  jack_set_process_callback(self->client, process, self.get());
+  self->bridge.allocate(self->outputBuffers.size(),
+                        jack_get_buffer_size(self->client));
+  jack_set_buffer_size_callback(self->client, buffer_size_changed, self.get());
+  jack_set_sample_rate_callback(self->client, sample_rate_changed, self.get());
+  jack_on_shutdown(self->client, shutdown, nullptr);
+  std::signal(SIGINT, signal_handler);
+  std::signal(SIGTERM, signal_handler);
+
+  if (jack_activate(self->client) != 0) {
+    std::cerr << "cantina_jack: could not activate client." << std::endl;
+    jack_client_close(self->client);
+    return EXIT_FAILURE;
+  }
+  connect_ports(self.get(), options);
+
+  std::cout << "Cant version : " CANTINA_VERSION << std::endl;
+  std::cout << "Cant brew    : " CANTINA_BREW << std::endl;
+  std::cout << "~ tut-tut-tut-tut-tulut-tut ~" << std::endl;
+
+  std::uint64_t errorsReported = 0;
+  while (running) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto const errors = self->errors.load(std::memory_order_relaxed);
+    if (errors != errorsReported) {
+      std::cerr << "cantina_jack: " << errors - errorsReported
+                << " error(s) while processing." << std::endl;
+      errorsReported = errors;
+    }
+  }
+
+  jack_deactivate(self->client);
+  jack_client_close(self->client);
+  if (options.coalesce) {
+    auto const &stats = self->coalescer.getStats();
+    std::cout << "controls: " << stats.controlsReceived << " received, "
+              << stats.controlsMerged << " merged; notes: "
+              << stats.notesReceived << " received, " << stats.notesDropped
+              << " dropped." << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
@@ -10,26 +10,45 @@
 
 #include <lv2/core/lv2.h>
 #include <lv2/atom/atom.h>
+#include <lv2/buf-size/buf-size.h>
 #include <lv2/patch/patch.h>
 #include <lv2/log/log.h>
 #include <lv2/log/logger.h>
 #include <lv2/midi/midi.h>
+#include <lv2/options/options.h>
 #include <lv2/urid/urid.h>
 
 #include <cant/Cantina.hpp>
 #include <cant/pan/Pantoufle.hpp>
 
+#include <cantina_common/coalesce.hpp>
+#include <cantina_common/gate.hpp>
+#include <cantina_common/sample.hpp>
+#include <cantina_common/voice_chain.hpp>
+
 enum EPortIndex {
     CANTINA_CONTROL = 0,
     CANTINA_NUMBERVOICES = 1,
     CANTINA_GAIN = 2,
     CANTINA_INPUT_SEED = 3,
     CANTINA_INPUT_TRACK = 4,
-    CANTINA_OUTPUT = 5
+    CANTINA_OUTPUT = 5,
+    CANTINA_GATE_THRESHOLD = 6,
+    CANTINA_GATE_HOLD = 7,
+    CANTINA_GATE_RELEASE = 8,
+    CANTINA_COALESCE = 9,
+    CANTINA_OUTPUT_RIGHT = 10,
+    CANTINA_VOICE_SPREAD = 11,
+    CANTINA_VOICE_DRIVE = 12,
+    CANTINA_VOICE_BITS = 13,
+    CANTINA_VOICE_DECIMATE = 14,
+    CANTINA_VOICE_TONE = 15
 } ;
 
 struct CantinaURIs {
     LV2_URID midi_Event;
+    LV2_URID atom_Int;
+    LV2_URID bufsz_maxBlockLength;
 };
 
 struct CantinaPlugin {
@@ -42,17 +61,50 @@ struct CantinaPlugin {
     struct {
         LV2_Atom_Sequence  const * control;
         float const * gain;
-        int const * nb_voices;
+        // read in activate() only, changing it rebuilds Cantina.
+        float const * nb_voices;
         float const * input_seed;
         float const * input_track;
         float * output;
+        float const * gate_threshold;
+        float const * gate_hold;
+        float const * gate_release;
+        float const * coalesce;
+        float * output_right;
+        float const * voice_spread;
+        float const * voice_drive;
+        float const * voice_bits;
+        float const * voice_decimate;
+        float const * voice_tone;
     } ports;
 
     double rate;
+    // frames processed so far, drives Cantina's clock.
+    uint64_t frames;
     //Cantina
     std::unique_ptr<cant::Cantina> cantina;
-    std::vector<std::vector<float>> outputBuffers;
-    // float **outputBuffers;
+    cant::plugin::ConfidenceGate gate;
+    cant::plugin::MidiCoalescer coalescer;
+    cant::plugin::VoiceChain chain;
+    struct {
+        float gain;
+        float spread;
+        float drive;
+        float bits;
+        float decimate;
+        float tone;
+    } chainSettings;
+    struct {
+        float threshold;
+        float hold;
+        float release;
+    } gateSettings;
+    // voices are rendered in Cantina's own sample type.
+    std::vector<std::vector<cant::sample_f>> outputBuffers;
+    std::vector<cant::sample_f *> interfaceBuffers;
+    // LV2 audio ports are float, converted only if Cantina's are not.
+    cant::plugin::SampleBridge<float> bridge;
+    // capacity of the buffers above, longer host blocks are split.
     uint32_t currentBlockSize;
 
 };
@@ -60,6 +112,8 @@ struct CantinaPlugin {
 static inline void
 map_cantina_uris(LV2_URID_Map * map, CantinaURIs * uris) {
     uris->midi_Event = map->map(map->handle, LV2_MIDI__MidiEvent);
+    uris->atom_Int = map->map(map->handle, LV2_ATOM__Int);
+    uris->bufsz_maxBlockLength = map->map(map->handle, LV2_BUF_SIZE__maxBlockLength);
 }
 
 #endif //CANTINA_LV2_INCLUDE_CANTINA_PLUGIN_HPP
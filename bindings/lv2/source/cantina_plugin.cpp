@@ -6,7 +6,9 @@
 #include <numeric>
 #include <cstdlib>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <new>
 #include <cmath>
 #include <vector>
 
@@ -15,43 +17,63 @@
 #include <lv2/atom/util.h>
 #include <lv2/core/lv2_util.h>
 
+#include <cantina_common/midi.hpp>
+
 #define DEFAULT_BUFFER_SIZE 1024
 #define DEFAULT_NB_VOICES 4
-
-static constexpr float db_gain_to_coef(float gain) {
-    return gain > -90.0f ? std::pow(10.0f, gain * 0.05f) : 0.0f;
-}
+#define MAX_NB_VOICES 10
 
 
 size_t get_block_size(CantinaPlugin *self) {
-    return self->outputBuffers.at(0).size();
+    return self->currentBlockSize;
+}
+
+void allocate_output_buffers(CantinaPlugin * self, size_t nb_voices, uint32_t block_size) {
+    self->currentBlockSize = block_size;
+    self->outputBuffers = std::vector<std::vector<cant::sample_f>>(nb_voices, std::vector<cant::sample_f>(block_size));
+    self->interfaceBuffers.resize(nb_voices);
+    std::transform(
+            self->outputBuffers.begin(),
+            self->outputBuffers.end(),
+            self->interfaceBuffers.begin(),
+            [](auto & buffer) { return buffer.data(); }
+            );
+    // only the inputs go through the bridge, voices are merged in merge_output.
+    self->bridge.allocate(0, block_size);
 }
 
+/**
+ * Longest block the host will ever run, DEFAULT_BUFFER_SIZE if it does not say.
+ */
+uint32_t read_max_block_size(CantinaPlugin * self, LV2_Options_Option const * options) {
+    for (auto option = options; option && option->key; ++option) {
+        if (option->key == self->uris.bufsz_maxBlockLength
+            && option->type == self->uris.atom_Int) {
+            auto const size = *reinterpret_cast<int32_t const *>(option->value);
+            if (size > 0) {
+                return static_cast<uint32_t>(size);
+            }
+        }
+    }
+    return DEFAULT_BUFFER_SIZE;
+}
 
 void set_cantina(CantinaPlugin * self, size_t nb_voices) {
-    auto cantina = std::make_unique<cant::Cantina>(
+    self->cantina = std::make_unique<cant::Cantina>(
             nb_voices,
             self->rate,
             1 // channel
             );
 
-    self->cantina->setCustomClock([&self]() -> double{
-        // last block size
-        return self->rate * get_block_size(self);
+    self->cantina->setCustomClock([self]() -> double {
+        return static_cast<double>(self->frames) / self->rate;
     });
-}
-
-void allocate_output_buffers(CantinaPlugin * self, size_t nb_voices, uint32_t block_size) {
-    self->outputBuffers = std::vector<std::vector<float>>(nb_voices, std::vector<float>(block_size));
-}
-void fit_output_buffers(CantinaPlugin * self, uint32_t block_size) {
-    if (block_size > self->outputBuffers.at(0).size()) {
-        std::for_each(
-                self->outputBuffers.begin(),
-                self->outputBuffers.end(),
-                [block_size](auto buffer){ buffer.resize(block_size); }
-                );
-    }
+    allocate_output_buffers(self, self->cantina->getNumberVoices(), get_block_size(self));
+    self->chain.setNumberVoices(self->cantina->getNumberVoices());
+    self->chain.setSampleRate(self->rate);
+    // forces the voice chain ports to be read again.
+    auto const unset = std::numeric_limits<float>::quiet_NaN();
+    self->chainSettings = {unset, unset, unset, unset, unset, unset};
 }
 
 static LV2_Handle
@@ -74,31 +96,29 @@ instantiate([[maybe_unused]] LV2_Descriptor const * descriptor,
         return nullptr;
     }
     self->rate = rate;
-    allocate_output_buffers(self, DEFAULT_NB_VOICES, DEFAULT_BUFFER_SIZE);
-    // default value for number of voices
+    self->frames = 0;
+    self->gate.setSampleRate(rate);
+    self->gateSettings = {0.f, -1.f, -1.f};
 
     // Scan host features for URID map
+    LV2_Options_Option const * options = nullptr;
     char const * missing = lv2_features_query(
             features,
             LV2_LOG__log, &self->logger.log, false,
             LV2_URID__map, &self->map, true,
+            LV2_OPTIONS__options, &options, false,
             nullptr);
     lv2_log_logger_set_map(&self->logger, self->map);
     if (missing) {
         lv2_log_error(&self->logger, "Missing feature <%s> \n", missing);
-        free(self);
+        delete self;
         return nullptr;
     }
 
     map_cantina_uris(self->map, &self->uris);
-
-    size_t nb_voices = self->ports.nb_voices ? *self->ports.nb_voices : DEFAULT_NB_VOICES;
-
-    try {
-        set_cantina(self, nb_voices);
-    } catch (cant::CantinaException const & e) {
-        std::cerr << e.what() << std::endl;
-    }
+    // buffers are sized once, never from run().
+    allocate_output_buffers(self, DEFAULT_NB_VOICES, read_max_block_size(self, options));
+    // Cantina is built in activate(), once the number of voices can be read.
 
     return reinterpret_cast<LV2_Handle>(self);
 }
@@ -108,43 +128,41 @@ static void
 cleanup(LV2_Handle instance) {
     auto self = reinterpret_cast<CantinaPlugin *>(instance);
     if (self) {
-        free(self);
+        delete self;
     }
 }
 
 
-void merge_output(CantinaPlugin * self) {
-    std::fill(self->ports.output, self->ports.output + get_block_size(self), 0.);
-    for (auto voice=0; voice < self->outputBuffers.size(); ++voice) {
-        std::transform(
-                self->ports.output,
-                self->ports.output + get_block_size(self),
-                self->outputBuffers.at(voice).begin(),
-                self->ports.output,
-                std::plus<float>()
-            );
+/**
+ * Voices go through their chain and into the mix in the same pass.
+ * Mono if the right output is not connected, panned otherwise.
+ */
+template <typename Sample>
+void merge_output(CantinaPlugin * self, Sample * output, Sample * output_right, uint32_t nb_samples) {
+    std::fill(output, output + nb_samples, Sample(0));
+    if (output_right) {
+        std::fill(output_right, output_right + nb_samples, Sample(0));
+    }
+    for (size_t voice = 0; voice < self->outputBuffers.size(); ++voice) {
+        auto const buffer = self->outputBuffers[voice].data();
+        if (output_right) {
+            self->chain.mix(voice, buffer, output, output_right, nb_samples);
+        } else {
+            self->chain.mix(voice, buffer, output, nb_samples);
+        }
     }
-    //  std::copy(output.begin(), output.end(), self->ports.output);
 }
 
 static void
 connect_port(LV2_Handle instance, uint32_t port, void * data) {
     auto self = reinterpret_cast<CantinaPlugin *>(instance);
-    size_t nb_voices;
     switch (static_cast<EPortIndex>(port)) {
         case CANTINA_CONTROL:
             self->ports.control = reinterpret_cast<LV2_Atom_Sequence const *>(data);
             break;
         case CANTINA_NUMBERVOICES:
-            self->ports.nb_voices = reinterpret_cast<int const *>(data);
-                nb_voices = self->ports.nb_voices ? *self->ports.nb_voices : DEFAULT_NB_VOICES;
-
-            // todo: reset Cantina
-            try {
-                set_cantina(self, nb_voices);
-            } catch (cant::CantinaException const & e) {
-                std::cerr << e.what() << std::endl;
-            }
+            // port data is not valid yet, read in activate().
+            self->ports.nb_voices = reinterpret_cast<float const*>(data);
             break;
         case CANTINA_GAIN:
             self->ports.gain = reinterpret_cast<float const*>(data);
@@ -158,14 +176,65 @@ connect_port(LV2_Handle instance, uint32_t port, void * data) {
         case CANTINA_OUTPUT:
             self->ports.output = reinterpret_cast<float *>(data);
             break;
+        case CANTINA_GATE_THRESHOLD:
+            self->ports.gate_threshold = reinterpret_cast<float const*>(data);
+            break;
+        case CANTINA_GATE_HOLD:
+            self->ports.gate_hold = reinterpret_cast<float const*>(data);
+            break;
+        case CANTINA_GATE_RELEASE:
+            self->ports.gate_release = reinterpret_cast<float const*>(data);
+            break;
+        case CANTINA_COALESCE:
+            self->ports.coalesce = reinterpret_cast<float const*>(data);
+            break;
+        case CANTINA_OUTPUT_RIGHT:
+            self->ports.output_right = reinterpret_cast<float *>(data);
+            break;
+        case CANTINA_VOICE_SPREAD:
+            self->ports.voice_spread = reinterpret_cast<float const*>(data);
+            break;
+        case CANTINA_VOICE_DRIVE:
+            self->ports.voice_drive = reinterpret_cast<float const*>(data);
+            break;
+        case CANTINA_VOICE_BITS:
+            self->ports.voice_bits = reinterpret_cast<float const*>(data);
+            break;
+        case CANTINA_VOICE_DECIMATE:
+            self->ports.voice_decimate = reinterpret_cast<float const*>(data);
+            break;
+        case CANTINA_VOICE_TONE:
+            self->ports.voice_tone = reinterpret_cast<float const*>(data);
+            break;
+    }
+}
+
+size_t read_nb_voices(CantinaPlugin * self) {
+    if (!self->ports.nb_voices) {
+        return DEFAULT_NB_VOICES;
     }
+    auto const nb_voices = std::lround(*self->ports.nb_voices);
+    return static_cast<size_t>(std::clamp<long>(nb_voices, 1, MAX_NB_VOICES));
 }
 
+/**
+ * Not real-time: Cantina is only rebuilt here,
+ * so a new number of voices takes effect on the next activation.
+ */
 static void
 activate(LV2_Handle instance) {
-    // todo
     auto self = reinterpret_cast<CantinaPlugin *>(instance);
-
+    auto const nb_voices = read_nb_voices(self);
+    if (self->cantina && self->cantina->getNumberVoices() == nb_voices) {
+        return;
+    }
+    try {
+        set_cantina(self, nb_voices);
+    } catch (cant::CantinaException const & e) {
+        std::cerr << e.what() << std::endl;
+    } catch (std::bad_alloc const &) {
+        lv2_log_error(&self->logger, "Failed to allocate %zu voices.\n", nb_voices);
+    }
 }
 
 static void
@@ -178,77 +247,120 @@ extension_data([[maybe_unused]] char const * uri) {
     return nullptr;
 }
 
+void update_gate(CantinaPlugin * self) {
+    auto & settings = self->gateSettings;
+    if (self->ports.gate_threshold && *self->ports.gate_threshold != settings.threshold) {
+        settings.threshold = *self->ports.gate_threshold;
+        self->gate.setThreshold(settings.threshold);
+    }
+    // times are given in ms.
+    if (self->ports.gate_hold && *self->ports.gate_hold != settings.hold) {
+        settings.hold = *self->ports.gate_hold;
+        self->gate.setHoldTime(settings.hold / 1000.);
+    }
+    if (self->ports.gate_release && *self->ports.gate_release != settings.release) {
+        settings.release = *self->ports.gate_release;
+        self->gate.setReleaseTime(settings.release / 1000.);
+    }
+}
+
+void update_voice_chain(CantinaPlugin * self) {
+    auto & settings = self->chainSettings;
+    auto & chain = self->chain;
+    auto const all = cant::plugin::VoiceChain::ALL_VOICES;
+    // output gain, applied to each voice in the same pass.
+    if (self->ports.gain && *self->ports.gain != settings.gain) {
+        settings.gain = *self->ports.gain;
+        chain.setGain(all, settings.gain);
+    }
+    // voices spread evenly from left to right.
+    if (self->ports.voice_spread && *self->ports.voice_spread != settings.spread) {
+        settings.spread = *self->ports.voice_spread;
+        auto const nb_voices = chain.getNumberVoices();
+        for (size_t voice = 0; voice < nb_voices; ++voice) {
+            auto const position = nb_voices > 1 ? 2. * voice / (nb_voices - 1) - 1. : 0.;
+            chain.setPan(voice, settings.spread * position);
+        }
+    }
+    if (self->ports.voice_drive && *self->ports.voice_drive != settings.drive) {
+        settings.drive = *self->ports.voice_drive;
+        chain.setDrive(all, settings.drive);
+    }
+    if ((self->ports.voice_bits && *self->ports.voice_bits != settings.bits)
+        || (self->ports.voice_decimate && *self->ports.voice_decimate != settings.decimate)) {
+        settings.bits = self->ports.voice_bits ? *self->ports.voice_bits : 0.f;
+        settings.decimate = self->ports.voice_decimate ? *self->ports.voice_decimate : 1.f;
+        chain.setCrush(all, static_cast<int>(settings.bits), settings.decimate);
+    }
+    if (self->ports.voice_tone && *self->ports.voice_tone != settings.tone) {
+        settings.tone = *self->ports.voice_tone;
+        chain.setTone(all, settings.tone);
+    }
+}
+
+template <typename Sample>
+void process_block(CantinaPlugin * self, cant::plugin::SampleBridge<Sample> & bridge,
+                   Sample const * input_seed, Sample const * input_track,
+                   Sample * output, Sample * output_right, uint32_t nb_samples) {
+    auto const nb_voices = self->cantina->getNumberVoices();
+    // converted only if Sample is not Cantina's sample type.
+    auto seed = bridge.seed(input_seed, nb_samples);
+    auto track = bridge.track(input_track, nb_samples);
+    for (auto buffer : self->interfaceBuffers) {
+        std::fill(buffer, buffer + nb_samples, cant::sample_f(0));
+    }
+
+    self->cantina->update();
+    if (self->gate.shouldPerform(nb_samples)) {
+        self->cantina->perform(seed, track, self->interfaceBuffers.data(), nb_samples);
+        self->gate.observe(self->cantina->getPitch().getConfidence(), nb_samples);
+    }
+    self->gate.apply(self->interfaceBuffers.data(), nb_voices, nb_samples);
+
+    merge_output(self, output, output_right, nb_samples);
+}
+
 static void
 run(LV2_Handle instance, uint32_t nb_samples) {
     auto self = reinterpret_cast<CantinaPlugin *>(instance);
+    if (!self->cantina) {
+        // failed to build, see activate().
+        std::fill(self->ports.output, self->ports.output + nb_samples, 0.f);
+        if (self->ports.output_right) {
+            std::fill(self->ports.output_right, self->ports.output_right + nb_samples, 0.f);
+        }
+        return;
+    }
 
-    fit_output_buffers(self, nb_samples);
+    update_gate(self);
+    update_voice_chain(self);
+    self->coalescer.setEnabled(self->ports.coalesce && *self->ports.coalesce > 0.f);
 
-    // Notes and controls
+    // Notes and controls, only the last value of each control is kept when coalescing.
     LV2_Atom_Sequence  const * seq = self->ports.control;
     LV2_ATOM_SEQUENCE_FOREACH(seq, ev) {
         if (ev->body.type != self->uris.midi_Event) { continue; }
         auto msg = reinterpret_cast<uint8_t const *>(ev + 1);
-        switch(lv2_midi_message_type(msg)) {
-            case LV2_MIDI_MSG_NOTE_ON:
-            case LV2_MIDI_MSG_NOTE_OFF:
-                try {
-                    self->cantina->receiveNote(
-                            cant::pan::MidiNoteInputData(
-                                    msg[0],
-                                    static_cast<int8_t>(msg[1]),
-                                    static_cast<int8_t>(msg[2])));
-                }
-                catch (cant::CantinaException const & e) {
-                    std::cerr << e.what() << std::endl;
-                }
-                break;
-            case LV2_MIDI_MSG_CONTROLLER:
-                try {
-                    self->cantina->receiveControl(
-                            cant::pan::MidiControlInputData(
-                                    msg[0],
-                                    static_cast<uint8_t>(msg[1]),
-                                    static_cast<uint8_t>(msg[2])));
-                }
-                catch (cant::CantinaException const & e) {
-                    std::cerr << e.what() << std::endl;
-                }
-                break;
-            default:
-                break;
-        }
+        self->coalescer.receiveMidi(*self->cantina, msg, ev->body.size);
     }
-
-    float **interfaceBuffers;
-    try {
-        // convert vector of vector of float to float**.
-        interfaceBuffers = new float*[self->cantina->getNumberVoices()];
-        std::transform(
-            self->outputBuffers.begin(),
-            self->outputBuffers.end(),
-            interfaceBuffers,
-            [](auto v) {
-                return v.data();
-            }
-        );
-    }
-    catch (const std::bad_alloc& ba)
-    {
-        return;
-    }
-
-    try {
-        self->cantina->update();
-
-        auto track = self->ports.input_track ? self->ports.input_track : self->ports.input_seed;
-        self->cantina->perform(self->ports.input_seed, track, interfaceBuffers, get_block_size(self));
-    } catch (cant::CantinaException const &e) {
-        std::cerr << e.what() << std::endl;
+    self->coalescer.flush(*self->cantina);
+
+    // split if the host runs longer blocks than it announced.
+    auto const seed = self->ports.input_seed;
+    auto const track = self->ports.input_track ? self->ports.input_track : seed;
+    auto const output_right = self->ports.output_right;
+    for (uint32_t offset = 0; offset < nb_samples;) {
+        auto const nb_block = std::min<uint32_t>(nb_samples - offset, get_block_size(self));
+        try {
+            process_block<float>(self, self->bridge, seed + offset, track + offset,
+                                 self->ports.output + offset,
+                                 output_right ? output_right + offset : nullptr, nb_block);
+        } catch (cant::CantinaException const &e) {
+            std::cerr << e.what() << std::endl;
+        }
+        self->frames += nb_block;
+        offset += nb_block;
     }
-    delete interfaceBuffers;
-
-    merge_output(self);
 }
 
 static LV2_Descriptor const descriptor = {
@@ -0,0 +1,167 @@
+//
+// Pool of pre-warmed Cantina engines for cantina~.
+//
+
+#ifndef LIB_CANTINA_TILDE_ENGINE_POOL_HPP
+#define LIB_CANTINA_TILDE_ENGINE_POOL_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <cant/Cantina.hpp>
+#include <cant/common/types.hpp>
+
+/** ADSR envelope with a MIDI damper: (damper controller id, channel) */
+using EnvelopeKey = std::pair<cant::pan::id_u8, cant::pan::id_u8>;
+
+/**
+ * @brief Engines can only be swapped between instances
+ * with the same number of voices, at the same sample rate,
+ * with the same envelopes added in the same order.
+ */
+struct EngineKey {
+  cant::size_u numberVoices;
+  cant::type_i sampleRate;
+  std::vector<EnvelopeKey> envelopes;
+
+  bool operator<(EngineKey const &other) const {
+    return std::tie(numberVoices, sampleRate, envelopes) <
+           std::tie(other.numberVoices, other.sampleRate, other.envelopes);
+  }
+};
+
+/**
+ * @brief An engine and the time its clock last reached.
+ * Engine time must only move forward, so new owners start their clock there.
+ */
+struct PooledEngine {
+  std::unique_ptr<cant::Cantina> engine;
+  cant::time_d time = 0.;
+};
+
+void add_adsr_envelope(cant::Cantina &engine, EnvelopeKey const &envelope);
+
+/**
+ * @brief An engine being built in the background.
+ */
+class EngineRequest {
+public:
+  [[nodiscard]] EngineKey const &getKey() const { return m_key; }
+  /**
+   * @brief Never blocks for long.
+   * @return true once the engine is built, and moves it out
+   * (null if construction failed).
+   */
+  bool poll(std::unique_ptr<cant::Cantina> &engine);
+  /** Whenever it is built, the engine goes to the pool instead. */
+  void abandon();
+
+private:
+  friend class EnginePool;
+
+  explicit EngineRequest(EngineKey key)
+      : m_key(std::move(key)), m_done(false), m_abandoned(false) {}
+
+  EngineKey m_key;
+  std::mutex m_mutex;
+  std::unique_ptr<cant::Cantina> m_engine;
+  bool m_done;
+  bool m_abandoned;
+};
+
+/**
+ * @brief Shared by every cantina~.
+ * Engines are handed out on creation and recycled on deletion,
+ * at most CAPACITY of them are kept per key.
+ *
+ * Building, recycling and destroying engines all happen on a single
+ * worker thread, so that they never stall pd's scheduler,
+ * and which is joined when pd exits.
+ * Cantina has no way to reset an engine, so recycled ones are drained
+ * instead: they process DRAIN_TIME of silence, which empties the tracker
+ * and lets released notes die out. They are not reset: state that lasts
+ * longer than that (e.g. longer envelope releases) carries over.
+ */
+class EnginePool {
+public:
+  static constexpr cant::size_u CAPACITY = 8;
+  static constexpr cant::time_d DRAIN_TIME = 2.; // s
+  static constexpr cant::size_u DRAIN_BLOCK_SIZE = 64;
+
+  static EnginePool &get();
+
+  /** Builds an engine in this thread. */
+  static std::unique_ptr<cant::Cantina> make(EngineKey const &key);
+
+  /** @return a pre-warmed engine, or a null one if none is ready. */
+  PooledEngine acquire(EngineKey const &key);
+  /**
+   * @brief Drains the engine in the background, then pools it.
+   * @param time the engine's time when handed back.
+   */
+  void recycle(EngineKey key, std::unique_ptr<cant::Cantina> engine,
+               cant::time_d time);
+  /** Destroys the engine in the background. */
+  void discard(std::unique_ptr<cant::Cantina> engine);
+
+  /** Takes precedence over recycling and pre-warming. */
+  std::shared_ptr<EngineRequest> request(EngineKey key);
+  /** Builds engines in the background until count of them are pooled. */
+  void prewarm(EngineKey const &key, cant::size_u count);
+
+  ~EnginePool();
+
+private:
+  friend class EngineRequest;
+
+  enum EJob {
+    JOB_BUILD = 0,
+    JOB_PREWARM,
+    JOB_RECYCLE,
+    // fresh engines, no need to drain them.
+    JOB_STORE,
+    JOB_DISCARD
+  };
+
+  struct Job {
+    EJob type;
+    EngineKey key;
+    std::unique_ptr<cant::Cantina> engine;
+    cant::time_d time;
+    std::shared_ptr<EngineRequest> request;
+  };
+
+  EnginePool();
+
+  void push(Job job, bool urgent);
+  void work();
+  void run(Job &job);
+  /** Pools the engine, @return false if there is no room left for it. */
+  bool store(EngineKey const &key, PooledEngine &pooled);
+  /** @return false if interrupted by pd exiting, or if the engine threw. */
+  bool drain(EngineKey const &key, PooledEngine &pooled);
+
+  std::mutex m_mutex;
+  std::condition_variable m_available;
+  std::map<EngineKey, std::vector<PooledEngine>> m_engines;
+  // engines being built for the pool.
+  std::map<EngineKey, cant::size_u> m_warming;
+  // requests go first, see request().
+  std::deque<Job> m_urgentJobs;
+  std::deque<Job> m_jobs;
+  std::atomic<bool> m_stop;
+  std::thread m_worker;
+};
+
+#endif // LIB_CANTINA_TILDE_ENGINE_POOL_HPP
@@ -5,6 +5,9 @@
 #include <algorithm>
 #include <cmath>
 #include <memory>
+#include <new>
+#include <utility>
+#include <vector>
 
 #include <cant/common/info.hpp>
 #include <cant/common/types.hpp>
@@ -17,14 +20,28 @@
 #include <cant/common/CantinaException.hpp>
 #include <cant/common/config.hpp>
 
+#include <cantina_common/coalesce.hpp>
+#include <cantina_common/gate.hpp>
+#include <cantina_common/sample.hpp>
+#include <cantina_common/voice_chain.hpp>
+
 extern "C" {
 #include <m_pd.h>
 }
 #include "../include/cantina~.hpp"
+#include "../include/engine_pool.hpp"
 
 /******** declaration ********/
 static t_class *cantina_tilde_class;
 
+/** how often a lazy instance checks on its engine (ms) **/
+static constexpr double CANTINA_TILDE_POLL_INTERVAL = 5.;
+/**
+ * Shared by every instance, so that engines handed over from one instance
+ * to the next never see their time go backwards. Set on setup.
+ */
+static double cantina_tilde_start_systime;
+
 /**
  * @brief First inlet is the signal to be tracked
  * if second inlet is not given, it is also the signal to be shifted (the seed).
@@ -44,11 +61,24 @@ typedef struct {
   /** pitch-tracking-related stuff **/
   t_outlet *x_out_pitch;
   /* internal */
+  /** null until ready, in lazy mode: outputs silence meanwhile **/
   std::unique_ptr<cant::Cantina> cantina;
+  /** voices and envelopes, the engine gets the ones it misses on adoption **/
+  EngineKey x_key;
+  /** lazy mode: engine being built in the background **/
+  std::shared_ptr<EngineRequest> x_request;
+  t_clock *x_clock;
+  cant::plugin::ConfidenceGate x_gate;
+  /** t_sample to Cantina's, when pd is built with 64-bit samples **/
+  cant::plugin::SampleBridge<t_sample> x_bridge;
+  /** controls are dispatched once per dsp tick, when coalescing **/
+  cant::plugin::MidiCoalescer x_coalescer;
+  /** gain, soft clip, crush, tone, in the same pass as the voice **/
+  cant::plugin::VoiceChain x_chain;
   /* cache */
   /** time **/
-  // see const!
-  double x_t_start_systime;
+  // engine time ahead of pd's, for engines handed over by the pool (s).
+  cant::time_d x_time_offset;
   /** dsp args **/
   std::vector<t_int> x_vec_dspargs;
   /** atoms (list) **/
@@ -78,34 +108,116 @@ void copy_pitch(t_cantina_tilde *x, const cant::Pitch &pitch) {
 
 /******** implementation ********/
 
+cant::time_d get_engine_time(t_cantina_tilde *x) {
+  return clock_gettimesince(cantina_tilde_start_systime) / 1000 +
+         x->x_time_offset;
+}
+
+/**
+ * @param engineKey what the engine was built with,
+ * the envelopes it misses from x_key are added.
+ */
+void adopt_engine(t_cantina_tilde *x, PooledEngine pooled,
+                  const EngineKey &engineKey) {
+  x->cantina = std::move(pooled.engine);
+  const double start_systime = cantina_tilde_start_systime;
+  // engine time only moves forward.
+  const cant::time_d offset = std::max<cant::time_d>(
+      0., pooled.time - clock_gettimesince(start_systime) / 1000);
+  x->x_time_offset = offset;
+  try {
+    /*
+     * So, there are issues with using <chrono> utility with pd,
+     * delta time is not regular.
+     * So now we hook pd's own clock system to our midi timer.
+     */
+    x->cantina->setCustomClock([start_systime, offset]() -> cant::time_d {
+      const cant::type_d t = clock_gettimesince(start_systime) / 1000 + offset;
+      return t;
+    });
+    const auto &envelopes = x->x_key.envelopes;
+    for (auto i = engineKey.envelopes.size(); i < envelopes.size(); ++i) {
+      add_adsr_envelope(*x->cantina, envelopes[i]);
+    }
+  } catch (const cant::CantinaException &e) {
+    std::cerr << e.what() << std::endl;
+    // half set up, not worth keeping.
+    EnginePool::get().discard(std::move(x->cantina));
+  }
+}
+
+/** Hands the engine back to the pool, it is never destroyed here. */
+void recycle_engine(t_cantina_tilde *x, EngineKey engineKey) {
+  try {
+    x->x_coalescer.releaseNotes(*x->cantina);
+  } catch (const cant::CantinaException &e) {
+    std::cerr << e.what() << std::endl;
+    EnginePool::get().discard(std::move(x->cantina));
+    return;
+  }
+  EnginePool::get().recycle(std::move(engineKey), std::move(x->cantina),
+                            get_engine_time(x));
+}
+
+void cantina_tilde_poll(t_cantina_tilde *x) {
+  std::unique_ptr<cant::Cantina> engine;
+  if (!x->x_request->poll(engine)) {
+    clock_delay(x->x_clock, CANTINA_TILDE_POLL_INTERVAL);
+    return;
+  }
+  auto request = std::move(x->x_request);
+  if (!engine) {
+    pd_error(x, "cantina~: failed to build engine.");
+    return;
+  }
+  adopt_engine(x, {std::move(engine), 0.}, request->getKey());
+}
+
 void *cantina_tilde_new(const t_symbol *, const int argc, t_atom *argv) {
   auto *x = reinterpret_cast<t_cantina_tilde *>(pd_new(cantina_tilde_class));
-  /* args */
+  /* args: [number of voices] [-lazy] */
   t_int n_arg = 0;
-  if (argc) {
-    n_arg = atom_getint(argv);
+  bool lazy = false;
+  for (int i = 0; i < argc; ++i) {
+    if (argv[i].a_type == A_SYMBOL) {
+      lazy = lazy || atom_getsymbol(argv + i) == gensym("-lazy");
+    } else {
+      n_arg = atom_getint(argv + i);
+    }
   }
   const auto numberHarmonics =
       static_cast<cant::size_u>(std::max<t_int>(0, n_arg));
-  /* time */
-  x->x_t_start_systime = clock_getlogicaltime();
+  /* pd_new does not construct members */
+  new (&x->cantina) std::unique_ptr<cant::Cantina>();
+  new (&x->x_request) std::shared_ptr<EngineRequest>();
+  new (&x->x_key) EngineKey{
+      numberHarmonics, static_cast<cant::type_i>(std::round(sys_getsr())), {}};
+  new (&x->x_gate) cant::plugin::ConfidenceGate();
+  new (&x->x_bridge) cant::plugin::SampleBridge<t_sample>();
+  new (&x->x_coalescer) cant::plugin::MidiCoalescer();
+  new (&x->x_chain) cant::plugin::VoiceChain();
+  x->x_time_offset = 0.;
+  x->x_clock = clock_new(x, reinterpret_cast<t_method>(cantina_tilde_poll));
+  x->x_gate.setSampleRate(sys_getsr());
+  x->x_chain.setNumberVoices(numberHarmonics);
+  x->x_chain.setSampleRate(sys_getsr());
   /* cantina */
   try {
-    x->cantina = std::make_unique<cant::Cantina>(
-        numberHarmonics,
-        static_cast<cant::type_i>(std::round(sys_getsr())), // sample rate
-        1                                                   // channel
-    );
-    const double start_systime = x->x_t_start_systime;
     /*
-     * So, there are issues with using <chrono> utility with pd,
-     * delta time is not regular.
-     * So now we hook pd's own clock system to our midi timer.
+     * Building an engine takes a while, and stalls pd's scheduler.
+     * So take one from the pool if there is one,
+     * or, when lazy, build it in the background and stay silent until then.
      */
-    x->cantina->setCustomClock([start_systime]() -> cant::time_d {
-      const cant::type_d t = clock_gettimesince(start_systime) / 1000;
-      return t;
-    });
+    auto pooled = EnginePool::get().acquire(x->x_key);
+    if (!pooled.engine && lazy) {
+      x->x_request = EnginePool::get().request(x->x_key);
+      clock_delay(x->x_clock, CANTINA_TILDE_POLL_INTERVAL);
+    } else {
+      if (!pooled.engine) {
+        pooled.engine = EnginePool::make(x->x_key);
+      }
+      adopt_engine(x, std::move(pooled), x->x_key);
+    }
   } catch (const cant::CantinaException &e) {
     std::cerr << e.what() << std::endl;
   }
@@ -121,11 +233,11 @@ void *cantina_tilde_new(const t_symbol *, const int argc, t_atom *argv) {
   x->x_out_pitch = outlet_new(&x->x_obj, &s_list);
   /** signals again **/
   x->x_out_harmonics = static_cast<t_outlet **>(
-      getbytes(x->cantina->getNumberVoices() * sizeof(t_outlet *)));
+      getbytes(x->x_key.numberVoices * sizeof(t_outlet *)));
   if (!x->x_out_harmonics) {
     bug("cantina~: failed to allocate harmonic outlets.");
   }
-  for (cant::size_u i = 0; i < x->cantina->getNumberVoices(); ++i) {
+  for (cant::size_u i = 0; i < x->x_key.numberVoices; ++i) {
     x->x_out_harmonics[i] = outlet_new(&x->x_obj, &s_signal);
   }
   /* atoms */
@@ -137,39 +249,72 @@ void cantina_tilde_free(t_cantina_tilde *x) {
   /* atom */
   free_control_atoms(x);
   /* utility */
-  // clock_free(x->x_clock);
+  clock_free(x->x_clock);
   /* inlets */
   /** signals **/
   inlet_free(x->x_in_track);
   /* outlets */
   /** signals **/
-  for (cant::size_u i = 0; i < x->cantina->getNumberVoices(); ++i) {
+  for (cant::size_u i = 0; i < x->x_key.numberVoices; ++i) {
     outlet_free(x->x_out_harmonics[i]);
   }
-  freebytes(x->x_out_harmonics,
-            x->cantina->getNumberVoices() * sizeof(t_outlet *));
+  freebytes(x->x_out_harmonics, x->x_key.numberVoices * sizeof(t_outlet *));
   /** scalars **/
   outlet_free(x->x_out_pitch);
   /* inlets */
   inlet_free(x->x_in_notes);
   inlet_free(x->x_in_controls);
   /** cantina **/
-  x->cantina.reset();
+  // never destroyed here, so that deleting instances mid-set does not stall.
+  if (x->x_request) {
+    x->x_request->abandon();
+  }
+  if (x->cantina) {
+    recycle_engine(x, x->x_key);
+  }
+  x->cantina.~unique_ptr<cant::Cantina>();
+  x->x_key.~EngineKey();
+  x->x_request.~shared_ptr<EngineRequest>();
+  x->x_bridge.~SampleBridge<t_sample>();
+  x->x_coalescer.~MidiCoalescer();
+  x->x_chain.~VoiceChain();
 }
 
 void fill_vec_dspargs(t_cantina_tilde *x, t_signal **sp) {
   auto &vec = x->x_vec_dspargs;
   /* dsp args vector */
-  vec = std::vector<t_int>(4 + x->cantina->getNumberVoices());
+  vec = std::vector<t_int>(4 + x->x_key.numberVoices);
   vec.at(0) = reinterpret_cast<t_int>(x);            // x
   vec.at(1) = static_cast<t_int>(sp[0]->s_n);        // block_size
   vec.at(2) = reinterpret_cast<t_int>(sp[0]->s_vec); // in seed
   vec.at(3) = reinterpret_cast<t_int>(sp[1]->s_vec); // in track
-  for (cant::size_u i = 0; i < x->cantina->getNumberVoices(); ++i) {
+  for (cant::size_u i = 0; i < x->x_key.numberVoices; ++i) {
     vec.at(4 + i) = reinterpret_cast<t_int>(sp[2 + i]->s_vec); // out harmonics
   }
 }
 
+template <typename Sample>
+void process_block(t_cantina_tilde *x, cant::plugin::SampleBridge<Sample> &bridge,
+                   Sample const *in_seed, Sample const *in_track,
+                   Sample **out_harmonics, std::size_t block_size) {
+  const auto numberVoices = x->cantina->getNumberVoices();
+  /* converted only if t_sample is not Cantina's sample type */
+  auto seed = bridge.seed(in_seed, block_size);
+  auto track = bridge.track(in_track, block_size);
+  /* reset before filling them again */
+  auto harmonics = bridge.outputs(out_harmonics, numberVoices, block_size);
+  x->cantina->update();
+  if (x->x_gate.shouldPerform(block_size)) {
+    x->cantina->perform(seed, track, harmonics, block_size);
+    x->x_gate.observe(x->cantina->getPitch().getConfidence(), block_size);
+  }
+  x->x_gate.apply(harmonics, numberVoices, block_size);
+  for (cant::size_u voice = 0; voice < numberVoices; ++voice) {
+    x->x_chain.process(voice, harmonics[voice], block_size);
+  }
+  bridge.commit(out_harmonics, numberVoices, block_size);
+}
+
 t_int *cantina_tilde_perform(t_int *w) {
   auto *x = reinterpret_cast<t_cantina_tilde *>(w[1]);
   auto block_size = static_cast<std::size_t>(w[2]);
@@ -181,16 +326,19 @@ t_int *cantina_tilde_perform(t_int *w) {
     in_track = in_seed;
   }
   auto **out_harmonics = reinterpret_cast<t_sample **>(&w[5]);
-  /** DOING STUFF **/
-  for (int i = 0; i < static_cast<int>(x->cantina->getNumberVoices()); ++i) {
-    /* resetting samples in outlet before filling it again */
-    std::fill(out_harmonics[i], out_harmonics[i] + block_size, 0.);
+  const auto size = static_cast<t_int>(x->x_vec_dspargs.size());
+  if (!x->cantina) {
+    // engine not ready yet.
+    for (cant::size_u i = 0; i < x->x_key.numberVoices; ++i) {
+      std::fill(out_harmonics[i], out_harmonics[i] + block_size, t_sample(0));
+    }
+    return (w + size + 1);
   }
-  // seed
   /** CANT **/
   try {
-    x->cantina->update();
-    x->cantina->perform(in_seed, in_track, out_harmonics, block_size);
+    x->x_coalescer.flush(*x->cantina);
+    process_block<t_sample>(x, x->x_bridge, in_seed, in_track, out_harmonics,
+                            block_size);
 
     copy_pitch(x, x->cantina->getPitch());
     outlet_list(x->x_out_pitch, &s_list, 2, x->x_a_pitch);
@@ -198,11 +346,14 @@ t_int *cantina_tilde_perform(t_int *w) {
   } catch (const cant::CantinaException &e) {
     std::cerr << e.what() << std::endl;
   }
-  const auto size = static_cast<t_int>(x->x_vec_dspargs.size());
   return (w + size + 1);
 }
 
 void cantina_tilde_dsp(t_cantina_tilde *x, t_signal **sp) {
+  x->x_gate.setSampleRate(sp[0]->s_sr);
+  x->x_chain.setSampleRate(sp[0]->s_sr);
+  x->x_bridge.allocate(x->x_key.numberVoices,
+                       static_cast<cant::size_u>(sp[0]->s_n));
   fill_vec_dspargs(x, sp);
   dsp_addv(cantina_tilde_perform, static_cast<int>(x->x_vec_dspargs.size()),
            x->x_vec_dspargs.data());
@@ -225,24 +376,88 @@ void cantina_tilde_envelope(t_cantina_tilde *x, t_symbol *, int argc,
           "need: damper controller id.",
           type.data());
     }
-    // make adsr envelope
-    auto adsr = cant::pan::ADSREnvelope::make(x->cantina->getNumberVoices());
-
-    // make damper
-    auto const controllerId =
-        static_cast<cant::pan::id_u8>(atom_getint(argv + 1));
-    auto const channel = static_cast<cant::pan::id_u8>(atom_getint(argv + 2));
-    auto damper = cant::pan::MidiDamper::make(channel, controllerId);
-
-    // link the two
-    adsr->setController(std::move(damper));
-    x->cantina->addEnvelope(std::move(adsr));
+    const EnvelopeKey envelope{
+        static_cast<cant::pan::id_u8>(atom_getint(argv + 1)), // controller id
+        static_cast<cant::pan::id_u8>(atom_getint(argv + 2))  // channel
+    };
+    const auto engineKey = x->x_key;
+    x->x_key.envelopes.push_back(envelope);
+    if (!x->cantina) {
+      // added once the engine is ready.
+      return;
+    }
+    /*
+     * Envelopes are usually set on load, so instances recreated
+     * with the same ones find an engine ready in the pool.
+     */
+    auto pooled = EnginePool::get().acquire(x->x_key);
+    if (pooled.engine) {
+      recycle_engine(x, engineKey);
+      adopt_engine(x, std::move(pooled), x->x_key);
+      return;
+    }
+    try {
+      add_adsr_envelope(*x->cantina, envelope);
+    } catch (const cant::CantinaException &e) {
+      std::cerr << e.what() << std::endl;
+      x->x_key.envelopes.pop_back();
+    }
   } else {
     bug("cantina~: envelope '%s' not known.", type.data());
     return;
   }
 }
 
+void cantina_tilde_gate(t_cantina_tilde *x, t_symbol *, int argc,
+                        t_atom *argv) {
+  if (argc < 1) {
+    bug("cantina~: Wrong format for gate: expected [threshold, "
+        "hold (ms), release (ms)], threshold 0 to disable");
+    return;
+  }
+  /* [threshold (in [0, 1]), hold (ms), release (ms)] */
+  x->x_gate.setThreshold(atom_getfloat(argv));
+  if (argc > 1) {
+    x->x_gate.setHoldTime(atom_getfloat(argv + 1) / 1000.);
+  }
+  if (argc > 2) {
+    x->x_gate.setReleaseTime(atom_getfloat(argv + 2) / 1000.);
+  }
+}
+
+void cantina_tilde_voice(t_cantina_tilde *x, t_symbol *, int argc,
+                         t_atom *argv) {
+  if (argc < 3) {
+    bug("cantina~: Wrong format for voice: expected [voice (from 1) or all, "
+        "stage, parameters...], stages: gain (dB), pan ([-1, 1]), "
+        "clip (drive, dB), crush (bit depth, rate), tone (Hz)");
+    return;
+  }
+  /* voices start at 1, like the outlets, 0 or 'all' for every one */
+  cant::size_u voice = cant::plugin::VoiceChain::ALL_VOICES;
+  if (argv->a_type != A_SYMBOL && atom_getint(argv) > 0) {
+    voice = static_cast<cant::size_u>(atom_getint(argv) - 1);
+  }
+  auto const stage = atom_getsymbol(argv + 1);
+  auto const value = atom_getfloat(argv + 2);
+  auto &chain = x->x_chain;
+  if (stage == gensym("gain")) {
+    chain.setGain(voice, value);
+  } else if (stage == gensym("pan")) {
+    // voice outlets are mono, only kept for consistency with the others.
+    chain.setPan(voice, value);
+  } else if (stage == gensym("clip")) {
+    chain.setDrive(voice, value);
+  } else if (stage == gensym("crush")) {
+    chain.setCrush(voice, static_cast<int>(value),
+                   argc > 3 ? atom_getfloat(argv + 3) : 1.);
+  } else if (stage == gensym("tone")) {
+    chain.setTone(voice, value);
+  } else {
+    bug("cantina~: voice stage '%s' not known.", stage->s_name);
+  }
+}
+
 void cantina_tilde_notes(t_cantina_tilde *x, t_symbol *, int argc,
                          t_atom *argv) {
   if (argc < 3) {
@@ -254,13 +469,10 @@ void cantina_tilde_notes(t_cantina_tilde *x, t_symbol *, int argc,
   auto const tone = static_cast<cant::pan::tone_i8>(atom_getfloat(argv));
   auto const velocity = static_cast<cant::pan::vel_i8>(atom_getfloat(argv + 1));
   auto const channel = static_cast<cant::pan::id_u8>(atom_getfloat(argv + 2));
-  auto const data = cant::pan::MidiNoteInputData(channel, tone, velocity);
-  std::optional<cant::size_u> optVoice;
-  try {
-    optVoice = x->cantina->receiveNote(data);
-  } catch (const cant::CantinaException &e) {
-    std::cerr << e.what() << std::endl;
+  if (!x->cantina) {
+    return;
   }
+  x->x_coalescer.receiveNote(*x->cantina, channel, tone, velocity);
 }
 
 void cantina_tilde_controls(t_cantina_tilde *x, t_symbol *, int argc,
@@ -283,13 +495,54 @@ void cantina_tilde_controls(t_cantina_tilde *x, t_symbol *, int argc,
   const auto controllerId =
       static_cast<cant::pan::id_u8>(atom_getint(argv + 1));
   const auto channel = static_cast<cant::pan::id_u8>(atom_getint(argv + 2));
-  const auto data =
-      cant::pan::MidiControlInputData(channel, controllerId, value);
-  try {
-    x->cantina->receiveControl(data);
-  } catch (const cant::CantinaException &e) {
-    std::cerr << e.what() << std::endl;
+  if (!x->cantina) {
+    return;
+  }
+  x->x_coalescer.receiveControl(*x->cantina, channel, controllerId, value);
+}
+
+void cantina_tilde_coalesce(t_cantina_tilde *x, t_symbol *, int argc,
+                            t_atom *argv) {
+  if (argc < 1) {
+    bug("cantina~: Wrong format for coalesce: expected [0/1] or [stats]");
+    return;
+  }
+  if (argv->a_type == A_SYMBOL) {
+    if (atom_getsymbol(argv) != gensym("stats")) {
+      bug("cantina~: coalesce: unknown argument '%s'.",
+          atom_getsymbol(argv)->s_name);
+      return;
+    }
+    const auto &stats = x->x_coalescer.getStats();
+    post("cantina~: controls: %lu received, %lu merged; "
+         "notes: %lu received, %lu dropped.",
+         static_cast<unsigned long>(stats.controlsReceived),
+         static_cast<unsigned long>(stats.controlsMerged),
+         static_cast<unsigned long>(stats.notesReceived),
+         static_cast<unsigned long>(stats.notesDropped));
+    return;
+  }
+  x->x_coalescer.setEnabled(atom_getfloat(argv) != 0);
+}
+
+void cantina_tilde_prewarm(t_cantina_tilde *x, t_symbol *, int argc,
+                           t_atom *argv) {
+  if (argc < 1) {
+    bug("cantina~: Wrong format for prewarm: expected [count, "
+        "number of voices], defaults to this object's voices");
+    return;
+  }
+  /*
+   * engines are built in the background, for the next instances to come,
+   * with this object's envelopes.
+   */
+  auto key = x->x_key;
+  if (argc > 1) {
+    key.numberVoices =
+        static_cast<cant::size_u>(std::max<t_int>(0, atom_getint(argv + 1)));
   }
+  EnginePool::get().prewarm(
+      key, static_cast<cant::size_u>(std::max<t_int>(0, atom_getint(argv))));
 }
 
 extern "C" void cantina_tilde_setup(void) {
@@ -309,13 +562,26 @@ extern "C" void cantina_tilde_setup(void) {
   class_addmethod(cantina_tilde_class,
                   reinterpret_cast<t_method>(cantina_tilde_envelope),
                   gensym("envelope"), A_GIMME, 0);
+  class_addmethod(cantina_tilde_class,
+                  reinterpret_cast<t_method>(cantina_tilde_gate),
+                  gensym("gate"), A_GIMME, 0);
+  class_addmethod(cantina_tilde_class,
+                  reinterpret_cast<t_method>(cantina_tilde_voice),
+                  gensym("voice"), A_GIMME, 0);
   class_addmethod(cantina_tilde_class,
                   reinterpret_cast<t_method>(cantina_tilde_notes),
                   gensym("notes"), A_GIMME, 0);
   class_addmethod(cantina_tilde_class,
                   reinterpret_cast<t_method>(cantina_tilde_controls),
                   gensym("controls"), A_GIMME, 0);
+  class_addmethod(cantina_tilde_class,
+                  reinterpret_cast<t_method>(cantina_tilde_coalesce),
+                  gensym("coalesce"), A_GIMME, 0);
+  class_addmethod(cantina_tilde_class,
+                  reinterpret_cast<t_method>(cantina_tilde_prewarm),
+                  gensym("prewarm"), A_GIMME, 0);
   CLASS_MAINSIGNALIN(cantina_tilde_class, t_cantina_tilde, f);
+  cantina_tilde_start_systime = clock_getlogicaltime();
   post("Cant version : " CANTINA_VERSION);
   post("Cant brew    : " CANTINA_BREW);
   post("~ tut-tut-tut-tut-tulut-tut ~");
@@ -0,0 +1,240 @@
+//
+// Pool of pre-warmed Cantina engines for cantina~.
+//
+
+#include "../include/engine_pool.hpp"
+
+#include <iostream>
+
+#include <cant/pan/control/control.hpp>
+#include <cant/pan/envelope/envelope.hpp>
+
+#include <cant/common/CantinaException.hpp>
+
+void add_adsr_envelope(cant::Cantina &engine, EnvelopeKey const &envelope) {
+  // make adsr envelope
+  auto adsr = cant::pan::ADSREnvelope::make(engine.getNumberVoices());
+  // make damper
+  auto damper = cant::pan::MidiDamper::make(envelope.second, envelope.first);
+  // link the two
+  adsr->setController(std::move(damper));
+  engine.addEnvelope(std::move(adsr));
+}
+
+bool EngineRequest::poll(std::unique_ptr<cant::Cantina> &engine) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_done) {
+    return false;
+  }
+  engine = std::move(m_engine);
+  return true;
+}
+
+void EngineRequest::abandon() {
+  std::unique_ptr<cant::Cantina> engine;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_abandoned = true;
+    if (!m_done) {
+      // picked up by the worker.
+      return;
+    }
+    engine = std::move(m_engine);
+  }
+  if (engine) {
+    // never used, no need to drain it.
+    EnginePool::get().push(
+        {EnginePool::JOB_STORE, m_key, std::move(engine), 0., nullptr}, false);
+  }
+}
+
+EnginePool &EnginePool::get() {
+  static EnginePool pool;
+  return pool;
+}
+
+EnginePool::EnginePool() : m_stop(false) {
+  m_worker = std::thread(&EnginePool::work, this);
+}
+
+EnginePool::~EnginePool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_available.notify_all();
+  m_worker.join();
+  // whatever is left is destroyed here, on pd's way out.
+}
+
+std::unique_ptr<cant::Cantina> EnginePool::make(EngineKey const &key) {
+  auto engine = std::make_unique<cant::Cantina>(key.numberVoices,
+                                                key.sampleRate,
+                                                1 // channel
+  );
+  for (auto const &envelope : key.envelopes) {
+    add_adsr_envelope(*engine, envelope);
+  }
+  return engine;
+}
+
+PooledEngine EnginePool::acquire(EngineKey const &key) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_engines.find(key);
+  if (it == m_engines.end() || it->second.empty()) {
+    return PooledEngine();
+  }
+  auto pooled = std::move(it->second.back());
+  it->second.pop_back();
+  return pooled;
+}
+
+void EnginePool::recycle(EngineKey key, std::unique_ptr<cant::Cantina> engine,
+                         cant::time_d time) {
+  push({JOB_RECYCLE, std::move(key), std::move(engine), time, nullptr}, false);
+}
+
+void EnginePool::discard(std::unique_ptr<cant::Cantina> engine) {
+  if (engine) {
+    push({JOB_DISCARD, EngineKey(), std::move(engine), 0., nullptr}, false);
+  }
+}
+
+std::shared_ptr<EngineRequest> EnginePool::request(EngineKey key) {
+  // constructor is private, no make_shared.
+  std::shared_ptr<EngineRequest> request(new EngineRequest(key));
+  push({JOB_BUILD, std::move(key), nullptr, 0., request}, true);
+  return request;
+}
+
+void EnginePool::prewarm(EngineKey const &key, cant::size_u count) {
+  cant::size_u missing;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto const available = m_engines[key].size() + m_warming[key];
+    count = std::min(count, CAPACITY);
+    missing = count > available ? count - available : 0;
+    m_warming[key] += missing;
+  }
+  for (cant::size_u i = 0; i < missing; ++i) {
+    push({JOB_PREWARM, key, nullptr, 0., nullptr}, false);
+  }
+}
+
+void EnginePool::push(Job job, bool urgent) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (urgent ? m_urgentJobs : m_jobs).push_back(std::move(job));
+  }
+  m_available.notify_one();
+}
+
+void EnginePool::work() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_available.wait(lock, [this]() {
+        return m_stop || !m_urgentJobs.empty() || !m_jobs.empty();
+      });
+      if (m_stop) {
+        return;
+      }
+      auto &jobs = m_urgentJobs.empty() ? m_jobs : m_urgentJobs;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    run(job);
+  }
+}
+
+void EnginePool::run(Job &job) {
+  PooledEngine pooled{std::move(job.engine), job.time};
+  switch (job.type) {
+  case JOB_BUILD:
+  case JOB_PREWARM:
+    try {
+      pooled.engine = make(job.key);
+    } catch (cant::CantinaException const &e) {
+      std::cerr << e.what() << std::endl;
+    }
+    if (job.type == JOB_PREWARM) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      --m_warming[job.key];
+    } else {
+      std::lock_guard<std::mutex> lock(job.request->m_mutex);
+      job.request->m_done = true;
+      if (!job.request->m_abandoned) {
+        job.request->m_engine = std::move(pooled.engine);
+      }
+    }
+    if (pooled.engine) {
+      store(job.key, pooled);
+    }
+    break;
+  case JOB_RECYCLE: {
+    // no point draining it if it is not kept.
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_engines[job.key].size() >= CAPACITY) {
+        break;
+      }
+    }
+    if (drain(job.key, pooled)) {
+      store(job.key, pooled);
+    }
+    break;
+  }
+  case JOB_STORE:
+    store(job.key, pooled);
+    break;
+  case JOB_DISCARD:
+  default:
+    break;
+  }
+  // engines that were not pooled are destroyed here, with pooled.
+}
+
+bool EnginePool::store(EngineKey const &key, PooledEngine &pooled) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto &engines = m_engines[key];
+  if (engines.size() >= CAPACITY) {
+    return false;
+  }
+  engines.push_back(std::move(pooled));
+  return true;
+}
+
+bool EnginePool::drain(EngineKey const &key, PooledEngine &pooled) {
+  auto &engine = *pooled.engine;
+  auto const numberVoices = engine.getNumberVoices();
+  std::vector<cant::sample_f> silence(DRAIN_BLOCK_SIZE, 0);
+  std::vector<std::vector<cant::sample_f>> outputs(
+      numberVoices, std::vector<cant::sample_f>(DRAIN_BLOCK_SIZE));
+  std::vector<cant::sample_f *> outputPointers(numberVoices);
+  for (cant::size_u voice = 0; voice < numberVoices; ++voice) {
+    outputPointers[voice] = outputs[voice].data();
+  }
+  auto const blockTime =
+      static_cast<cant::time_d>(DRAIN_BLOCK_SIZE) / key.sampleRate;
+  // time keeps going from where the last owner left it.
+  cant::time_d time = pooled.time;
+  auto const end = time + DRAIN_TIME;
+  bool drained = true;
+  try {
+    engine.setCustomClock([&time]() -> cant::time_d { return time; });
+    for (; time < end && drained; time += blockTime) {
+      engine.update();
+      engine.perform(silence.data(), silence.data(), outputPointers.data(),
+                     DRAIN_BLOCK_SIZE);
+      drained = !m_stop;
+    }
+  } catch (cant::CantinaException const &e) {
+    std::cerr << e.what() << std::endl;
+    drained = false;
+  }
+  // must not outlive this function, the new owner sets its own anyway.
+  engine.setCustomClock([time]() -> cant::time_d { return time; });
+  pooled.time = time;
+  return drained;
+}